@@ -23,10 +23,13 @@ Understanding the Server:
      to pthread_create(), and run_acceptor() casts it back and uses it.
 
 2. How are received messages stored?
-   - Each client thread (run_client) reads messages into a local buffer,
-     allocates a new struct list_node, allocates a data buffer for the
-     message, copies the message into that buffer, and then calls
-     add_to_list() to append the node to the end of a singly linked list.
+   - Each client thread (run_client) keeps a chain of preallocated
+     BUF_SIZE message buffers and fills them with one readv() call. Every
+     buffer that fills up becomes the data of a new struct list_node as it
+     is, without a copy, and is replaced by a fresh buffer; a partial
+     message stays at the front of the chain for the next read. The nodes
+     are appended to the end of a singly linked list with add_to_list(),
+     all under one lock.
      The list_handle keeps a pointer to the last node and a count of how
      many messages have been added.
 
@@ -77,11 +80,14 @@ Why are these sockets made non-blocking? What purpose does it serve?
        2) The client threads can keep looping and check the run flag
           instead of blocking forever in read() when the client stops
           sending data. This lets the program stop all threads gracefully.
+          They wait in poll() with a timeout rather than spinning on
+          read(), then read until the socket is empty.
 */
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
@@ -89,6 +95,7 @@ Why are these sockets made non-blocking? What purpose does it serve?
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #define BUF_SIZE 1024
@@ -96,6 +103,10 @@ Why are these sockets made non-blocking? What purpose does it serve?
 #define LISTEN_BACKLOG 32
 #define MAX_CLIENTS 4
 #define NUM_MSG_PER_CLIENT 5
+// Message buffers one readv scatters into.
+#define CHAIN_LEN 8
+// How long a client thread waits for data before checking its run flag.
+#define POLL_TIMEOUT_MS 100
 
 #define handle_error(msg)                                                      \
   do {                                                                         \
@@ -195,29 +206,106 @@ static void *run_client(void *args) {
   int cfd = cargs->cfd;
   set_non_blocking(cfd);
 
-  char msg_buf[BUF_SIZE];
+  // Preallocated message buffers that readv scatters into. A buffer that
+  // fills up becomes the data of a list node as it is, and a new one takes
+  // its place, so messages are never copied. bufs[0] may already hold the
+  // start of a message from the previous read.
+  char *bufs[CHAIN_LEN];
+  for (int i = 0; i < CHAIN_LEN; i++) {
+    bufs[i] = malloc(BUF_SIZE);
+    if (bufs[i] == NULL) {
+      handle_error("malloc");
+    }
+  }
+  size_t filled = 0;
+
+  struct pollfd pfd = {.fd = cfd, .events = POLLIN};
+  uint32_t num_msgs = 0;
+  uint32_t num_calls = 0; // poll and readv calls
+  bool open = true;
+
+  while (cargs->run && open) {
+    // Wait for data instead of spinning on EAGAIN, waking up now and then
+    // to check the run flag.
+    int ready = poll(&pfd, 1, POLL_TIMEOUT_MS);
+    num_calls++;
+    if (ready == -1 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    if (ready <= 0) {
+      continue;
+    }
 
-  while (cargs->run) {
-    ssize_t bytes_read = read(cfd, &msg_buf, BUF_SIZE);
-    if (bytes_read == -1) {
-      if (!(errno == EAGAIN || errno == EWOULDBLOCK)) {
-        perror("Problem reading from socket!\n");
+    // Drain the socket, up to CHAIN_LEN messages per readv.
+    for (;;) {
+      struct iovec iov[CHAIN_LEN];
+      iov[0].iov_base = bufs[0] + filled;
+      iov[0].iov_len = BUF_SIZE - filled;
+      for (int i = 1; i < CHAIN_LEN; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = BUF_SIZE;
+      }
+      size_t room = CHAIN_LEN * BUF_SIZE - filled;
+
+      ssize_t bytes_read = readv(cfd, iov, CHAIN_LEN);
+      num_calls++;
+      if (bytes_read == -1) {
+        if (!(errno == EAGAIN || errno == EWOULDBLOCK)) {
+          perror("Problem reading from socket!\n");
+          open = false;
+        }
+        break;
+      }
+      if (bytes_read == 0) {
+        // Client closed the connection; an incomplete message is dropped.
+        open = false;
+        break;
+      }
+
+      // Every full buffer is one message. All of them go into the list
+      // under a single lock.
+      size_t total = filled + (size_t)bytes_read;
+      int full = (int)(total / BUF_SIZE);
+      if (full > 0) {
+        pthread_mutex_lock(cargs->list_lock);
+        for (int i = 0; i < full; i++) {
+          struct list_node *new_node = malloc(sizeof(struct list_node));
+          new_node->next = NULL;
+          new_node->data = bufs[i];
+          add_to_list(cargs->list_handle, new_node);
+        }
+        pthread_mutex_unlock(cargs->list_lock);
+
+        for (int i = 0; i < full; i++) {
+          bufs[i] = malloc(BUF_SIZE);
+          if (bufs[i] == NULL) {
+            handle_error("malloc");
+          }
+        }
+        // The start of the next message moves to the front of the chain.
+        if (full < CHAIN_LEN) {
+          char *partial = bufs[full];
+          bufs[full] = bufs[0];
+          bufs[0] = partial;
+        }
+        num_msgs += (uint32_t)full;
+      }
+      filled = total % BUF_SIZE;
+
+      // A short read emptied the socket, so skip the read that would only
+      // return EAGAIN.
+      if ((size_t)bytes_read < room) {
         break;
       }
-    } else if (bytes_read > 0) {
-      // Create node with data
-      struct list_node *new_node = malloc(sizeof(struct list_node));
-      new_node->next = NULL;
-      new_node->data = malloc(BUF_SIZE);
-      memcpy(new_node->data, msg_buf, BUF_SIZE);
-
-      struct list_handle *list_handle = cargs->list_handle;
-      pthread_mutex_lock(cargs->list_lock);
-      add_to_list(cargs->list_handle, new_node);
-      pthread_mutex_unlock(cargs->list_lock);
     }
   }
 
+  printf("Client thread: %u messages in %u poll and read calls\n", num_msgs,
+         num_calls);
+  for (int i = 0; i < CHAIN_LEN; i++) {
+    free(bufs[i]);
+  }
   if (close(cfd) == -1) {
     perror("client thread close");
   }
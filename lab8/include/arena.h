@@ -0,0 +1,39 @@
+// Lab 8 - Bump arena backing word count entries and uthash tables
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Regular slabs are this size and aligned to it, so the arena owning any
+// small allocation can be found by rounding its address down.
+#define ARENA_SLAB_SIZE ((size_t)1 << 20)
+
+// Requests bigger than this get a slab of their own.
+#define ARENA_LARGE_ALLOC (ARENA_SLAB_SIZE / 4)
+
+typedef struct arena_slab arena_slab_t;
+
+typedef struct arena {
+  arena_slab_t *slabs; // every slab owned, most recent first
+  char *cur;           // bump pointer into the current regular slab
+  char *end;
+  size_t num_slabs;
+} arena_t;
+
+arena_t *arena_create(void);
+
+// Returns 16-byte aligned memory that lives until the arena is released.
+// Not thread-safe: callers serialize access to one arena.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Moves all of src's slabs into dst and frees src.
+void arena_adopt(arena_t *dst, arena_t *src);
+
+// Returns the arena that owns ptr. Only valid for allocations of at most
+// ARENA_LARGE_ALLOC bytes.
+arena_t *arena_of(const void *ptr);
+
+// Unmaps every slab in one pass and frees the arena itself.
+void arena_release(arena_t *arena);
+
+#endif
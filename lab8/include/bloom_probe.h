@@ -0,0 +1,26 @@
+// Lab 8 - Miss-heavy uthash lookups with and without HASH_BLOOM
+#ifndef BLOOM_PROBE_H
+#define BLOOM_PROBE_H
+
+#include "tokenizer.h"
+
+typedef struct {
+  unsigned bloom_bits;    // log2 of the filter size, 0 without a filter
+  size_t hits;            // queries found in the table
+  size_t misses;          // queries not in the table
+  size_t false_positives; // misses the filter let through to the buckets
+  double seconds;         // best time for all queries
+} bloom_probe_result_t;
+
+// Fills a uthash table with keys (hashes already interned), then looks up
+// every query repeats times. src/bloom_probe.c is compiled once without and
+// once with HASH_BLOOM: the option changes the layout of UT_hash_table, so the
+// two builds get distinct names and never share a map with the rest of lab8.
+void bloom_probe_off(const token_t *keys, size_t num_keys,
+                     const token_t *queries, size_t num_queries, int repeats,
+                     bloom_probe_result_t *result);
+void bloom_probe_on(const token_t *keys, size_t num_keys,
+                    const token_t *queries, size_t num_queries, int repeats,
+                    bloom_probe_result_t *result);
+
+#endif
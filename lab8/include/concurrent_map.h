@@ -0,0 +1,46 @@
+// Lab 8 - Lock-free chained word count map shared by all workers
+#ifndef CONCURRENT_MAP_H
+#define CONCURRENT_MAP_H
+
+#include "arena.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The bucket array is sized once from the expected number of words and never
+// resized, so it is clamped to a sane range. Past the top, chains just grow.
+#define CMAP_MIN_BUCKETS_LOG2 10
+#define CMAP_MAX_BUCKETS_LOG2 20
+
+// Nodes are immutable once published, except for count. They are never
+// removed while the map is in use.
+typedef struct cmap_node {
+  const char *word; // not owned, not NUL-terminated
+  uint32_t len;
+  uint32_t hash;
+  _Atomic size_t count;
+  struct cmap_node *next;
+} cmap_node_t;
+
+// Lookups only follow atomic bucket heads and immutable next pointers, so
+// they never wait. A hit is one atomic fetch-add on the node's count; a new
+// word is pushed onto its chain with a single CAS on the bucket head.
+typedef struct {
+  _Atomic(cmap_node_t *) *buckets;
+  size_t mask;
+  arena_t **arenas; // one per worker, so allocating a node takes no lock
+  size_t num_workers;
+} concurrent_map_t;
+
+void concurrent_map_init(concurrent_map_t *map, size_t expected_words,
+                         size_t num_workers);
+
+// Adds one to the count of word. Safe to call from any number of threads at
+// once, as long as no two of them pass the same worker index.
+void concurrent_map_add(concurrent_map_t *map, size_t worker, const char *word,
+                        size_t len, uint32_t hash);
+
+// Frees the buckets and every node. No thread may still be adding.
+void concurrent_map_destroy(concurrent_map_t *map);
+
+#endif
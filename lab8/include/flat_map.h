@@ -0,0 +1,46 @@
+// Lab 8 - Open-addressing word count table probed 16 slots at a time
+#ifndef FLAT_MAP_H
+#define FLAT_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Slots are probed in aligned groups of this many, one SSE2 compare each.
+#define FLAT_GROUP_SIZE 16
+
+// Tag of a slot that has never been used. Full slots hold a 7-bit tag taken
+// from the hash, so the high bit alone tells empty from full.
+#define FLAT_EMPTY 0x80
+
+typedef struct {
+  const char *word; // not owned, not NUL-terminated
+  uint32_t len;
+  uint32_t hash;
+  size_t count;
+} flat_slot_t;
+
+// Tags and slots are parallel arrays: a probe only touches the 16-byte tag
+// group until a tag matches, so misses rarely read the slots at all.
+typedef struct {
+  uint8_t *tags;
+  flat_slot_t *slots;
+  size_t capacity; // power of two, at least FLAT_GROUP_SIZE
+  size_t size;
+} flat_map_t;
+
+void flat_map_init(flat_map_t *map);
+void flat_map_destroy(flat_map_t *map);
+
+// Returns the count of word, or NULL if it is not in the table. hash is the
+// same 32-bit value that was given to flat_map_add.
+size_t *flat_map_find(const flat_map_t *map, const char *word, size_t len,
+                      uint32_t hash);
+
+// Adds n to the count of word, inserting it first if needed.
+void flat_map_add(flat_map_t *map, const char *word, size_t len, uint32_t hash,
+                  size_t n);
+
+// Adds every count of src into dst and destroys src.
+void flat_map_merge(flat_map_t *dst, flat_map_t *src);
+
+#endif
@@ -0,0 +1,187 @@
+// Lab 8 - Shared declarations for the uthash word counter
+#ifndef LAB8_H
+#define LAB8_H
+
+#include "arena.h"
+#include "tokenizer.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// uthash allocates its tables through these, so with arenas enabled the
+// buckets come from the same arena as the entries of the map.
+void *word_count_alloc(size_t size);
+void word_count_free(void *ptr, size_t size);
+#define uthash_malloc(sz) word_count_alloc(sz)
+#define uthash_free(ptr, sz) word_count_free(ptr, sz)
+
+// The hash behind every table is picked at build time with -DLAB8_HASH=...;
+// uthash itself falls back to HASH_JEN.
+#include "word_hash.h"
+#if defined(LAB8_HASH_FNV1A)
+#define LAB8_HASH_NAME "fnv1a"
+#define HASH_FUNCTION(keyptr, keylen, hashv)                                   \
+  ((hashv) = hash_fnv1a(keyptr, keylen))
+#elif defined(LAB8_HASH_WYHASH)
+#define LAB8_HASH_NAME "wyhash"
+#define HASH_FUNCTION(keyptr, keylen, hashv)                                   \
+  ((hashv) = hash_wyhash(keyptr, keylen))
+#else
+#define LAB8_HASH_NAME "jen"
+#endif
+
+#include "uthash.h"
+
+// Words handed out per scheduler task.
+#define DEFAULT_CHUNK_SIZE 4096
+
+// Words a thread collects privately in batched mode before it takes the lock.
+#define DEFAULT_BATCH_SIZE 2048
+
+// Number of independently locked sub-tables in the sharded map. Must be a
+// power of two so the shard can be taken from the top bits of the hash.
+#define SHARD_COUNT_LOG2 6
+#define SHARD_COUNT (1U << SHARD_COUNT_LOG2)
+
+typedef const char *word_t;
+
+// word is not necessarily NUL-terminated (it may point into a mapped file);
+// its length is hh.keylen.
+typedef struct {
+  word_t word;
+  size_t count;
+  UT_hash_handle hh;
+} word_count_entry_t;
+
+typedef word_count_entry_t *count_map_t;
+
+// What the workers count into. Selected at compile time: uthash by default,
+// or the SSE2 open-addressing table with -DLAB8_FLAT_MAP=ON. Either way the
+// result is handed back as a count_map_t.
+#ifdef LAB8_FLAT_MAP
+#include "flat_map.h"
+typedef flat_map_t word_table_t;
+#else
+typedef count_map_t word_table_t;
+#endif
+
+// How count_words_parallel synchronizes the worker threads.
+typedef enum {
+  COUNT_MODE_MUTEX,    // one map behind a single mutex
+  COUNT_MODE_SHARDED,  // SHARD_COUNT maps, each behind its own mutex
+  COUNT_MODE_LOCAL,    // one private map per thread, tree-merged at the end
+  COUNT_MODE_LOCKFREE, // one shared lock-free map with atomic counts
+  COUNT_MODE_BATCHED,  // one map behind a mutex, taken once per batch
+} count_mode_t;
+
+typedef struct {
+  count_mode_t mode;
+  size_t num_threads; // 0 means default_thread_count()
+  size_t chunk_size;  // 0 means DEFAULT_CHUNK_SIZE
+  size_t batch_size;  // batched mode only; 0 means DEFAULT_BATCH_SIZE
+  int numa;           // pin workers node by node and keep their data local
+} count_options_t;
+
+// One sub-table of the sharded map, padded so neighbouring locks do not share
+// a cache line.
+typedef struct {
+  word_table_t table;
+  arena_t *arena;
+  pthread_mutex_t lock;
+} __attribute__((aligned(64))) count_shard_t;
+
+typedef struct {
+  count_shard_t shards[SHARD_COUNT];
+} sharded_map_t;
+
+typedef struct {
+  size_t mallocs;      // malloc calls for entries and uthash tables
+  size_t frees;        // matching free calls
+  size_t arena_allocs; // allocations served from arenas instead
+} alloc_stats_t;
+
+// Makes every map built afterwards allocate its entries and uthash tables
+// from a per-map bump arena, released as a whole by delete_table. Must not
+// change while any map exists.
+void set_arena_enabled(int enabled);
+void get_alloc_stats(alloc_stats_t *stats);
+void reset_alloc_stats(void);
+
+typedef struct {
+  size_t acquisitions; // times a count lock (mutex or shard) was taken
+  uint64_t wait_ns;    // total time spent waiting to take them
+  uint64_t hold_ns;    // total time they were held
+} lock_stats_t;
+
+// Makes the workers time every acquisition of the locks guarding the count
+// tables. Off by default, since it adds three clock reads per acquisition.
+void set_lock_stats_enabled(int enabled);
+void get_lock_stats(lock_stats_t *stats);
+void reset_lock_stats(void);
+
+// Where the workers of the last count_words_parallel or count_files_parallel
+// calls ran, relative to their data. The per-task node tracking is always
+// collected; it costs one sched_getcpu() per task. remote_pages reads
+// numastat for every node, so it is only collected with count_options_t.numa
+// and stays 0 otherwise.
+typedef struct {
+  size_t nodes;             // NUMA nodes the process may run on
+  size_t tasks;             // scheduler tasks counted
+  size_t remote_tasks;      // counted on another node than their slice's
+  size_t node_switches;     // a worker was on another node than last task
+  size_t merges;            // local mode: tables merged into another
+  size_t cross_node_merges; // of which the two tables were on other nodes
+  uint64_t remote_pages;    // numastat other_node growth, system-wide
+} numa_stats_t;
+
+void get_numa_stats(numa_stats_t *stats);
+void reset_numa_stats(void);
+
+word_count_entry_t *create_entry(word_t, size_t);
+void free_entry(word_count_entry_t *entry);
+
+count_map_t count_words_seq(word_t *words, size_t num_words);
+count_map_t count_words_parallel(word_t *words, size_t num_words,
+                                 const count_options_t *opts);
+
+// Counts the words of the mapped files. The entries point into the mappings,
+// so the files must stay mapped until the map is deleted.
+count_map_t count_files_parallel(const mapped_file_t *files, size_t num_files,
+                                 const count_options_t *opts);
+
+void merge_count_maps(count_map_t *dst, count_map_t src);
+
+// The uthash hash of a word (LAB8_HASH_NAME); every table and shard lookup
+// uses this value.
+unsigned hash_word(const char *word, size_t len);
+
+// Fill in the hash (and, for intern_words, the length) of each token once,
+// ahead of counting. Lookups then go through HASH_FIND_BYHASHVALUE, which
+// only compares bytes when both the hash and the length already match.
+void intern_tokens(token_t *tokens, size_t num_tokens);
+void intern_words(const word_t *words, size_t num_words, token_t *tokens);
+
+const char *word_table_backend(void);
+void word_table_init(word_table_t *table);
+void word_table_add(word_table_t *table, const char *word, size_t len,
+                    unsigned hashv);
+void word_table_add_count(word_table_t *table, const char *word, size_t len,
+                          unsigned hashv, size_t n);
+// Returns a pointer to the word's count, or NULL if it is not in the table.
+size_t *word_table_find(word_table_t *table, const char *word, size_t len,
+                        unsigned hashv);
+void word_table_destroy(word_table_t *table);
+
+void sharded_map_init(sharded_map_t *shards);
+count_map_t sharded_map_flatten(sharded_map_t *shards);
+
+size_t default_thread_count(void);
+
+int parse_count_mode(const char *name, count_mode_t *mode);
+const char *count_mode_name(count_mode_t mode);
+
+int sort_func(word_count_entry_t *a, word_count_entry_t *b);
+
+void print_counts(count_map_t);
+void delete_table(count_map_t);
+
+#endif
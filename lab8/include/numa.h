@@ -0,0 +1,43 @@
+// Lab 8 - NUMA topology from sysfs, worker placement and pinning
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NUMA_MAX_NODES 64
+
+// The CPUs this process may run on, grouped by NUMA node. Nodes are numbered
+// densely from 0 here; node_id maps them back to the kernel's numbers.
+typedef struct {
+  size_t num_nodes;
+  int node_id[NUMA_MAX_NODES];
+  int *cpus; // cpus[node_first[n] .. node_first[n + 1]) are on node n
+  size_t node_first[NUMA_MAX_NODES + 1];
+  int *node_of_cpu; // dense node of each CPU number, -1 if not usable
+  size_t cpu_limit; // node_of_cpu has this many entries
+} numa_topology_t;
+
+// Reads /sys/devices/system/node. Without it, all usable CPUs form one node.
+// Returns 0, or -1 if not even the affinity mask could be read.
+int numa_topology_load(numa_topology_t *topo);
+void numa_topology_free(numa_topology_t *topo);
+
+// Spreads num_workers workers over the nodes in contiguous blocks, so that
+// neighbouring worker indices share a node, and gives each one a CPU of its
+// node, round-robin. Fills cpu[i] and node[i] for every worker.
+void numa_place_workers(const numa_topology_t *topo, size_t num_workers,
+                        int *cpu, int *node);
+
+// Restricts the calling thread to cpu. Returns 0, or -1 with errno set.
+int numa_pin_thread(int cpu);
+
+// The dense node the calling thread is running on right now, or -1.
+int numa_current_node(const numa_topology_t *topo);
+
+// Pages the kernel allocated on a node for a process running on another
+// node, summed over all nodes (other_node in numastat). System-wide, so
+// only meaningful on an otherwise idle machine. 0 without sysfs.
+uint64_t numa_remote_pages(const numa_topology_t *topo);
+
+#endif
@@ -0,0 +1,56 @@
+// Lab 8 - Buffered, printf-free output of word count entries
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "lab8.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+// Header of the binary dump, followed by a uint64_t number of records. Each
+// record is a uint64_t count, a uint32_t word length and the word's bytes,
+// unpadded. Integers are in host byte order.
+#define OUTPUT_BINARY_MAGIC "LAB8WC01"
+
+typedef enum {
+  OUTPUT_TEXT,   // the print_counts table, byte for byte
+  OUTPUT_TSV,    // word<TAB>count lines, no header
+  OUTPUT_BINARY, // see OUTPUT_BINARY_MAGIC
+  OUTPUT_PRINTF, // the text table through printf, for comparison
+} output_format_t;
+
+// Collects output in a caller-owned buffer and hands it to write(2) only
+// when it is full, so a whole table takes a handful of system calls and no
+// stdio locking.
+typedef struct {
+  int fd;
+  char *buf;
+  size_t cap;
+  size_t len;
+  int error; // errno of the first failed write, 0 if none
+  size_t bytes_written;
+  size_t num_writes; // write(2) calls so far
+} out_buf_t;
+
+void out_buf_init(out_buf_t *out, int fd, char *buf, size_t cap);
+
+// Writes out everything buffered so far. Returns 0, or -1 with errno set if
+// this or any earlier write failed.
+int out_flush(out_buf_t *out);
+
+void out_bytes(out_buf_t *out, const void *data, size_t len);
+
+// Formats value in decimal into dst, which must have room for 20 bytes.
+// Returns the number of bytes written; no NUL is added.
+size_t format_uint(char *dst, uint64_t value);
+
+// Writes entries to out in format and flushes it. Returns 0, or -1 with errno
+// set. OUTPUT_PRINTF goes through stdout instead and ignores out.
+int write_entries(out_buf_t *out, word_count_entry_t **entries, size_t count,
+                  output_format_t format);
+
+// Parses text, tsv, binary or printf. Returns 0, or -1 if name is unknown.
+int parse_output_format(const char *name, output_format_t *format);
+
+#endif
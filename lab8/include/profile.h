@@ -0,0 +1,52 @@
+// Lab 8 - Optional per-phase, per-thread and hardware-counter profiling
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  PHASE_MAP,     // mapping the input files
+  PHASE_COUNT,   // workers tokenizing and counting, launch to join
+  PHASE_MERGE,   // combining per-thread or per-shard tables into one map
+  PHASE_SORT,    // ordering the entries for output
+  PHASE_PRINT,   // writing the table
+  PHASE_CLEANUP, // deleting the table and unmapping the files
+  PHASE_COUNT_OF,
+} profile_phase_t;
+
+// What one worker thread spent its time on. Only the worker itself writes its
+// slot, and it is read after the join.
+typedef struct {
+  uint64_t wall_ns;     // first task to last
+  uint64_t tokenize_ns; // scanning spans and hashing words
+  uint64_t count_ns;    // updating tables, lock waits included
+  uint64_t lock_wait_ns;
+  uint64_t lock_hold_ns;
+  size_t lock_acquisitions;
+  size_t tasks;
+  size_t words;
+} profile_worker_t;
+
+// Turns profiling on and starts the hardware counters, if perf_event_open is
+// available. Must be called before any worker thread is started, since the
+// counters only follow threads created afterwards.
+void profile_enable(void);
+int profile_enabled(void);
+
+uint64_t profile_now_ns(void);
+
+// Phases may be entered more than once; their times add up. No-ops while
+// profiling is off.
+void profile_phase_begin(profile_phase_t phase);
+void profile_phase_end(profile_phase_t phase);
+
+// Makes room for num_workers worker slots, all zeroed. Returns NULL while
+// profiling is off, and the slots otherwise.
+profile_worker_t *profile_workers(size_t num_workers);
+
+// Writes everything recorded so far as one JSON object.
+void profile_report(FILE *out, const char *mode, size_t num_threads);
+
+#endif
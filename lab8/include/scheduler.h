@@ -0,0 +1,44 @@
+// Lab 8 - Work-stealing scheduler over a fixed set of task indices
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The tasks [top, bottom) still owned by one worker. Both ends are packed into
+// a single word so that the owner taking from the top and a thief taking from
+// the bottom are each one compare-and-swap, with no lock.
+typedef struct {
+  _Atomic uint64_t range;
+} __attribute__((aligned(64))) task_deque_t;
+
+typedef struct {
+  task_deque_t *deques;
+  size_t num_workers;
+  size_t num_tasks;
+  const int *worker_node; // NUMA node of each worker, or NULL
+} task_scheduler_t;
+
+// Splits tasks [0, num_tasks) into num_workers contiguous ranges, one per
+// worker deque.
+void scheduler_init(task_scheduler_t *sched, size_t num_workers,
+                    size_t num_tasks);
+void scheduler_destroy(task_scheduler_t *sched);
+
+// Makes workers steal from workers on their own node before they look at
+// other nodes. worker_node must outlive the scheduler.
+void scheduler_set_nodes(task_scheduler_t *sched, const int *worker_node);
+
+// The worker whose initial range holds task, and that range itself.
+size_t scheduler_home_worker(const task_scheduler_t *sched, size_t task);
+void scheduler_home_range(const task_scheduler_t *sched, size_t worker,
+                          size_t *begin, size_t *end);
+
+// Hands worker its next task. Takes from the front of its own deque first and
+// otherwise steals the back half of another worker's deque, on the same node
+// first if nodes are set. Returns 0 once no
+// work is left anywhere, 1 otherwise.
+int scheduler_next(task_scheduler_t *sched, size_t worker, size_t *task);
+
+#endif
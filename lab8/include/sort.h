@@ -0,0 +1,22 @@
+// Lab 8 - Parallel ordering of count map entries for output
+#ifndef SORT_H
+#define SORT_H
+
+#include "lab8.h"
+
+// Returns all entries of map in sort_func order, in a malloc'd array of *count
+// pointers. The bucket array of the map is split across num_threads threads,
+// which each collect and sort their part before the parts are merged.
+word_count_entry_t **sort_entries_parallel(count_map_t map, size_t num_threads,
+                                           size_t *count);
+
+// Returns the k most frequent entries, highest count first and ties in word
+// order, in a malloc'd array of *count <= k pointers. Each thread keeps a
+// bounded heap of its part of the map, so nothing else is sorted.
+word_count_entry_t **top_k_entries(count_map_t map, size_t k,
+                                   size_t num_threads, size_t *count);
+
+// Prints entries in the same format as print_counts.
+void print_entries(word_count_entry_t **entries, size_t count);
+
+#endif
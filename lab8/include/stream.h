@@ -0,0 +1,45 @@
+// Lab 8 - Continuous word counting over a stream with periodic snapshots
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "output.h"
+#include <stddef.h>
+
+// Input is read and handed to the workers in chunks of at most this many
+// bytes, cut after the last complete line.
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+#define DEFAULT_STREAM_INTERVAL_MS 1000
+#define DEFAULT_STREAM_TOP_K 10
+
+// How often a followed file is checked for new data once its end is reached.
+#define STREAM_FOLLOW_POLL_MS 100
+
+typedef struct {
+  size_t num_threads;   // 0 means default_thread_count()
+  size_t top_k;         // 0 means DEFAULT_STREAM_TOP_K
+  unsigned interval_ms; // 0 means DEFAULT_STREAM_INTERVAL_MS
+  int follow;           // at end of input, wait for more like tail -f
+  output_format_t format;
+} stream_options_t;
+
+// Counts the words read from fd until it ends (or, with follow, until
+// stream_stop is called), and writes a snapshot of the top_k words to stdout
+// every interval_ms and once more at the end.
+//
+// Each worker counts into the first of two private tables. On every
+// interval a publisher thread starts a new epoch; a worker notices it between
+// chunks, switches to its other table and leaves the full one to the
+// publisher, which merges it into the running totals. Snapshots are built in
+// the one of two buffers no reader holds. So neither the publisher nor any
+// reader of a snapshot ever makes a worker wait.
+//
+// Returns 0, or -1 with errno set if reading or writing failed. Arenas (-a)
+// must be off, since entries are freed one by one.
+int stream_count(int fd, const stream_options_t *opts);
+
+// Makes a running stream_count finish its current chunks, write its final
+// snapshot and return. Async-signal-safe.
+void stream_stop(void);
+
+#endif
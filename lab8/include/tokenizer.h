@@ -0,0 +1,53 @@
+// Lab 8 - Zero-copy tokenizer over memory-mapped input files
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Spans handed to one worker at a time are about this many bytes, extended to
+// the end of the line they stop in.
+#define TOKENIZE_SPAN_SIZE (256 * 1024)
+
+typedef struct {
+  const char *data; // read-only mapping of the whole file, NULL if empty
+  size_t size;
+} mapped_file_t;
+
+// A line-aligned byte range [begin, end) of a mapped file.
+typedef struct {
+  const char *begin;
+  const char *end;
+} text_span_t;
+
+// Words are handed to the callback this many at a time.
+#define TOKEN_BATCH_SIZE 256
+
+// A word with its length and hash kept next to it, so that once the hash is
+// filled in no lookup has to measure or hash the word again. word points
+// straight into the mapping and is not NUL-terminated.
+typedef struct {
+  const char *word;
+  uint32_t len;
+  uint32_t hash;
+} token_t;
+
+// Called with up to TOKEN_BATCH_SIZE words at a time. The tokenizer leaves
+// hash unset; the callback may fill it in place.
+typedef void (*token_fn_t)(void *ctx, token_t *tokens, size_t num_tokens);
+
+// Maps path read-only. Returns 0 on success, -1 with errno set on failure.
+int map_file(const char *path, mapped_file_t *file);
+void unmap_file(mapped_file_t *file);
+
+// Cuts every file into spans of about span_size bytes that start and end on
+// line boundaries. Returns the number of spans stored in *spans, which the
+// caller frees.
+size_t split_spans(const mapped_file_t *files, size_t num_files,
+                   size_t span_size, text_span_t **spans);
+
+// Calls fn for the words in span, in order and in batches. A word is a run of
+// ASCII letters, digits, '_', '\'' or non-ASCII (UTF-8) bytes.
+void tokenize_span(const text_span_t *span, token_fn_t fn, void *ctx);
+
+#endif
@@ -0,0 +1,28 @@
+// Lab 8 - Hash functions that can back uthash's HASH_FUNCTION hook
+#ifndef WORD_HASH_H
+#define WORD_HASH_H
+
+#include <stddef.h>
+
+// All of these return 32 bits so they can stand in for uthash's hashv. The
+// sharded map takes the shard from the top bits and uthash the bucket from the
+// bottom bits, so both ends have to be well mixed.
+typedef unsigned (*word_hash_fn_t)(const void *key, size_t len);
+
+typedef struct {
+  const char *name;
+  word_hash_fn_t fn;
+} word_hash_t;
+
+// Bob Jenkins' hash, uthash's default (HASH_JEN).
+unsigned hash_jen(const void *key, size_t len);
+// 32-bit FNV-1a, one multiply per byte.
+unsigned hash_fnv1a(const void *key, size_t len);
+// wyhash (final version 4), folded from 64 to 32 bits.
+unsigned hash_wyhash(const void *key, size_t len);
+
+// Every function above, for benchmarks that compare them at runtime.
+extern const word_hash_t word_hashes[];
+extern const size_t num_word_hashes;
+
+#endif
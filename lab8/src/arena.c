@@ -0,0 +1,112 @@
+// Lab 8 - Bump arena backing word count entries and uthash tables
+#include "arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN 16
+
+// Placed at the start of every slab.
+struct arena_slab {
+  arena_t *owner;
+  arena_slab_t *next;
+  size_t size;
+} __attribute__((aligned(ARENA_ALIGN)));
+
+static size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+// Maps size bytes aligned to ARENA_SLAB_SIZE by over-mapping and trimming.
+static arena_slab_t *map_slab(arena_t *owner, size_t size) {
+  size_t span = size + ARENA_SLAB_SIZE;
+  char *p = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+
+  char *aligned = (char *)round_up((uintptr_t)p, ARENA_SLAB_SIZE);
+  if (aligned > p) {
+    munmap(p, aligned - p);
+  }
+  munmap(aligned + size, (p + span) - (aligned + size));
+
+  arena_slab_t *slab = (arena_slab_t *)aligned;
+  slab->owner = owner;
+  slab->size = size;
+  slab->next = owner->slabs;
+  owner->slabs = slab;
+  owner->num_slabs++;
+  return slab;
+}
+
+arena_t *arena_create(void) {
+  arena_t *arena = malloc(sizeof(arena_t));
+  arena->slabs = NULL;
+  arena->cur = NULL;
+  arena->end = NULL;
+  arena->num_slabs = 0;
+  return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = round_up(size ? size : 1, ARENA_ALIGN);
+
+  if (size > ARENA_LARGE_ALLOC) {
+    // Large blocks (bucket arrays of big tables) get a dedicated slab, which
+    // leaves the current slab's bump pointer untouched.
+    arena_slab_t *slab =
+        map_slab(arena, round_up(sizeof(arena_slab_t) + size, ARENA_SLAB_SIZE));
+    return slab + 1;
+  }
+
+  if ((size_t)(arena->end - arena->cur) < size) {
+    arena_slab_t *slab = map_slab(arena, ARENA_SLAB_SIZE);
+    arena->cur = (char *)(slab + 1);
+    arena->end = (char *)slab + ARENA_SLAB_SIZE;
+  }
+
+  void *p = arena->cur;
+  arena->cur += size;
+  return p;
+}
+
+void arena_adopt(arena_t *dst, arena_t *src) {
+  if (src == dst) {
+    return;
+  }
+
+  arena_slab_t *last = NULL;
+  for (arena_slab_t *slab = src->slabs; slab; slab = slab->next) {
+    slab->owner = dst;
+    last = slab;
+  }
+  if (last) {
+    last->next = dst->slabs;
+    dst->slabs = src->slabs;
+  }
+  dst->num_slabs += src->num_slabs;
+
+  // Keep bump-allocating from whichever current slab has more room left.
+  if (src->end - src->cur > dst->end - dst->cur) {
+    dst->cur = src->cur;
+    dst->end = src->end;
+  }
+  free(src);
+}
+
+arena_t *arena_of(const void *ptr) {
+  uintptr_t base = (uintptr_t)ptr & ~(uintptr_t)(ARENA_SLAB_SIZE - 1);
+  return ((arena_slab_t *)base)->owner;
+}
+
+void arena_release(arena_t *arena) {
+  arena_slab_t *slab = arena->slabs;
+  while (slab) {
+    arena_slab_t *next = slab->next;
+    munmap(slab, slab->size);
+    slab = next;
+  }
+  free(arena);
+}
@@ -0,0 +1,1105 @@
+// Lab 8 - Thread-count scaling benchmark for the word counter
+#include "bloom_probe.h"
+#include "lab8.h"
+#include "output.h"
+#include "sort.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  char *storage;  // all distinct words, NUL-separated
+  word_t *vocab;  // vocab[i] points into storage
+  word_t *words;  // the corpus, each entry points at a vocab word
+  size_t num_words;
+  size_t vocab_size;
+} corpus_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+// Draws vocabulary ranks from a Zipf distribution: rank i (from 0) has
+// weight 1 / (i + 1)^skew, so a skew of 1 gives the classic text shape where
+// the top word is twice as frequent as the second.
+typedef struct {
+  double *cdf; // cdf[i] is the total weight of ranks 0..i
+  size_t n;
+} zipf_t;
+
+static void zipf_init(zipf_t *z, size_t n, double skew) {
+  z->cdf = malloc(n * sizeof(double));
+  z->n = n;
+  double total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += pow((double)(i + 1), -skew);
+    z->cdf[i] = total;
+  }
+}
+
+static size_t zipf_next(const zipf_t *z, uint64_t *state) {
+  // 53 random bits, scaled to [0, total)
+  double u = (xorshift64(state) >> 11) * 0x1.0p-53 * z->cdf[z->n - 1];
+  size_t lo = 0, hi = z->n - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (z->cdf[mid] > u) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// Builds a corpus of num_words words drawn from vocab_size distinct words,
+// uniformly if skew is 0 and from a Zipf distribution with that skew
+// otherwise.
+static void corpus_init(corpus_t *c, size_t num_words, size_t vocab_size,
+                        double skew, uint64_t seed) {
+  const size_t max_word_len = 16;
+
+  c->storage = malloc(vocab_size * max_word_len);
+  c->vocab = malloc(vocab_size * sizeof(word_t));
+  c->words = malloc(num_words * sizeof(word_t));
+  c->num_words = num_words;
+  c->vocab_size = vocab_size;
+
+  char *p = c->storage;
+  for (size_t i = 0; i < vocab_size; i++) {
+    c->vocab[i] = p;
+    p += snprintf(p, max_word_len, "w%zu", i) + 1;
+  }
+
+  uint64_t state = seed ? seed : 1;
+  if (skew <= 0) {
+    for (size_t i = 0; i < num_words; i++) {
+      c->words[i] = c->vocab[xorshift64(&state) % vocab_size];
+    }
+    return;
+  }
+
+  zipf_t zipf;
+  zipf_init(&zipf, vocab_size, skew);
+  for (size_t i = 0; i < num_words; i++) {
+    c->words[i] = c->vocab[zipf_next(&zipf, &state)];
+  }
+  free(zipf.cdf);
+}
+
+static void corpus_free(corpus_t *c) {
+  free(c->words);
+  free(c->vocab);
+  free(c->storage);
+}
+
+// Sanity check so a broken mode cannot produce a good-looking number.
+static int check_map(count_map_t map, const corpus_t *c) {
+  size_t total = 0;
+  word_count_entry_t *current, *tmp;
+  HASH_ITER(hh, map, current, tmp) { total += current->count; }
+  return total == c->num_words ? 0 : -1;
+}
+
+typedef struct {
+  size_t num_words;
+  size_t vocab_size;
+  double skew; // Zipf skew of synthetic corpora, 0 for uniform
+  size_t max_threads;
+  size_t chunk_size;
+  int repeats;
+  char **files; // words are read from these instead, if any
+  size_t num_files;
+} bench_params_t;
+
+// Lowers the process's peak RSS to its current RSS, so the next peak_rss_kb()
+// covers only what follows. Memory malloc kept from earlier runs still
+// counts. Needs Linux 4.0; on older kernels the peak is since startup.
+static void reset_peak_rss(void) {
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (f) {
+    fputs("5", f);
+    fclose(f);
+  }
+}
+
+static size_t peak_rss_kb(void) {
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[256];
+  size_t kb = 0;
+  while (f && fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "VmHWM: %zu kB", &kb) == 1) {
+      break;
+    }
+  }
+  if (f) {
+    fclose(f);
+  }
+  if (kb == 0) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    kb = (size_t)usage.ru_maxrss;
+  }
+  return kb;
+}
+
+// Counts the corpus once per repeat with count_words_parallel, or with
+// count_words_seq if opts is NULL. Returns the best time, or -1 if a run
+// produced a wrong table. *peak_kb is the peak RSS of the best run.
+static double time_count(const corpus_t *c, const count_options_t *opts,
+                         int repeats, size_t *peak_kb) {
+  double best = 0;
+  for (int r = 0; r < repeats; r++) {
+    reset_peak_rss();
+    double start = now_sec();
+    count_map_t map = opts ? count_words_parallel(c->words, c->num_words, opts)
+                           : count_words_seq(c->words, c->num_words);
+    double elapsed = now_sec() - start;
+    size_t kb = peak_rss_kb();
+
+    if (check_map(map, c) == -1) {
+      return -1;
+    }
+    delete_table(map);
+
+    if (r == 0 || elapsed < best) {
+      best = elapsed;
+      *peak_kb = kb;
+    }
+  }
+  return best;
+}
+
+// Counts the corpus with count_words_seq, then with each mode at 1, 2, 4, ...
+// max_threads threads. speedup is over the same mode at one thread, and
+// efficiency is speedup per thread; vs_seq is the speedup over the
+// sequential count. Also run as "contention", with a vocabulary small enough
+// that every thread keeps hitting the same few words, and as "zipf" at
+// several skews.
+static int bench_scaling(const bench_params_t *p) {
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->vocab_size, p->skew, 42);
+
+  printf("# %zu words, %zu distinct, skew %.2f, best of %d, %.1f MB RSS "
+         "before counting\n",
+         p->num_words, p->vocab_size, p->skew, p->repeats,
+         peak_rss_kb() / 1024.0);
+  printf("%-10s%-8s%-10s%-10s%-9s%-11s%-8s%-10s\n", "mode", "threads",
+         "seconds", "Mwords/s", "speedup", "efficiency", "vs_seq", "peak_MB");
+
+  size_t peak_kb = 0;
+  double seq = time_count(&corpus, NULL, p->repeats, &peak_kb);
+  if (seq < 0) {
+    fprintf(stderr, "seq: wrong total\n");
+    return 1;
+  }
+  printf("%-10s%-8d%-10.4f%-10.2f%-9.2f%-11.2f%-8.2f%-10.1f\n", "seq", 1,
+         seq, corpus.num_words / seq / 1e6, 1.0, 1.0, 1.0, peak_kb / 1024.0);
+
+  const count_mode_t modes[] = {COUNT_MODE_MUTEX, COUNT_MODE_SHARDED,
+                                COUNT_MODE_LOCAL, COUNT_MODE_LOCKFREE,
+                                COUNT_MODE_BATCHED};
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    double base = 0;
+    for (size_t threads = 1; threads <= p->max_threads; threads *= 2) {
+      count_options_t opts = {
+          .mode = modes[m],
+          .num_threads = threads,
+          .chunk_size = p->chunk_size,
+      };
+      double best = time_count(&corpus, &opts, p->repeats, &peak_kb);
+      if (best < 0) {
+        fprintf(stderr, "%s: wrong total with %zu threads\n",
+                count_mode_name(modes[m]), threads);
+        return 1;
+      }
+
+      if (threads == 1) {
+        base = best;
+      }
+      printf("%-10s%-8zu%-10.4f%-10.2f%-9.2f%-11.2f%-8.2f%-10.1f\n",
+             count_mode_name(modes[m]), threads, best,
+             corpus.num_words / best / 1e6, base / best,
+             base / best / threads, seq / best, peak_kb / 1024.0);
+    }
+  }
+
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Runs the scaling benchmark on Zipf corpora of growing skew, from uniform
+// to a handful of words making up most of the text. With -z, only that skew.
+static int bench_zipf(bench_params_t *p) {
+  const double skews[] = {0.0, 0.8, 1.0, 1.2};
+  if (p->skew > 0) {
+    return bench_scaling(p);
+  }
+  for (size_t i = 0; i < sizeof(skews) / sizeof(skews[0]); i++) {
+    p->skew = skews[i];
+    if (bench_scaling(p) != 0) {
+      return 1;
+    }
+    printf("\n");
+  }
+  return 0;
+}
+
+// Counts the corpus at max_threads threads with the mutex mode, which locks
+// once per word, and with the batched mode at growing batch sizes. Lock stats
+// are on for all runs, so each row shows how many acquisitions there were and
+// how long the lock was held.
+static int bench_batch(const bench_params_t *p) {
+  const size_t batch_sizes[] = {0, 16, 256, 2048, 16384};
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->vocab_size, p->skew, 42);
+  set_lock_stats_enabled(1);
+
+  printf("# %zu words, %zu distinct, %zu threads, best of %d\n", p->num_words,
+         p->vocab_size, p->max_threads, p->repeats);
+  printf("%-10s%-8s%-10s%-10s%-14s%-10s%-10s\n", "mode", "batch", "seconds",
+         "Mwords/s", "acquisitions", "held_ms", "ns/acq");
+
+  for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+    count_options_t opts = {
+        .mode = batch_sizes[b] ? COUNT_MODE_BATCHED : COUNT_MODE_MUTEX,
+        .num_threads = p->max_threads,
+        .chunk_size = p->chunk_size,
+        .batch_size = batch_sizes[b],
+    };
+    double best = 0;
+    lock_stats_t stats;
+
+    for (int r = 0; r < p->repeats; r++) {
+      reset_lock_stats();
+      double start = now_sec();
+      count_map_t map =
+          count_words_parallel(corpus.words, corpus.num_words, &opts);
+      double elapsed = now_sec() - start;
+
+      if (check_map(map, &corpus) == -1) {
+        fprintf(stderr, "batch: wrong total with batch size %zu\n",
+                batch_sizes[b]);
+        return 1;
+      }
+      delete_table(map);
+
+      if (r == 0 || elapsed < best) {
+        best = elapsed;
+        get_lock_stats(&stats);
+      }
+    }
+
+    printf("%-10s%-8zu%-10.4f%-10.2f%-14zu%-10.2f%-10.1f\n",
+           count_mode_name(opts.mode), batch_sizes[b] ? batch_sizes[b] : 1,
+           best, corpus.num_words / best / 1e6, stats.acquisitions,
+           stats.hold_ns / 1e6,
+           stats.acquisitions ? (double)stats.hold_ns / stats.acquisitions
+                              : 0.0);
+  }
+
+  set_lock_stats_enabled(0);
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Counts the corpus at max_threads threads with and without NUMA placement
+// (count_options_t.numa) in each mode, and prints the throughput next to the
+// cross-node counters of the best run.
+static int bench_numa(const bench_params_t *p) {
+  const count_mode_t modes[] = {COUNT_MODE_LOCAL, COUNT_MODE_SHARDED,
+                                COUNT_MODE_LOCKFREE, COUNT_MODE_BATCHED};
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->vocab_size, p->skew, 42);
+  numa_stats_t numa;
+  get_numa_stats(&numa);
+
+  printf("# %zu words, %zu distinct, %zu threads, %zu nodes, best of %d\n",
+         p->num_words, p->vocab_size, p->max_threads, numa.nodes, p->repeats);
+  printf("%-10s%-8s%-10s%-10s%-9s%-9s%-10s%-9s%-10s\n", "mode", "pinned",
+         "seconds", "Mwords/s", "speedup", "remote", "switches", "x_merge",
+         "rem_pages");
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    double base = 0;
+    for (int pinned = 0; pinned <= 1; pinned++) {
+      count_options_t opts = {
+          .mode = modes[m],
+          .num_threads = p->max_threads,
+          .chunk_size = p->chunk_size,
+          .numa = pinned,
+      };
+      double best = 0;
+      numa_stats_t stats;
+
+      for (int r = 0; r < p->repeats; r++) {
+        reset_numa_stats();
+        double start = now_sec();
+        count_map_t map =
+            count_words_parallel(corpus.words, corpus.num_words, &opts);
+        double elapsed = now_sec() - start;
+
+        if (check_map(map, &corpus) == -1) {
+          fprintf(stderr, "numa: wrong total in %s mode\n",
+                  count_mode_name(modes[m]));
+          return 1;
+        }
+        delete_table(map);
+
+        if (r == 0 || elapsed < best) {
+          best = elapsed;
+          get_numa_stats(&stats);
+        }
+      }
+
+      if (!pinned) {
+        base = best;
+      }
+      // remote_pages is only collected with placement.
+      char pages[24] = "-";
+      if (pinned) {
+        snprintf(pages, sizeof(pages), "%llu",
+                 (unsigned long long)stats.remote_pages);
+      }
+      printf("%-10s%-8s%-10.4f%-10.2f%-9.2f%-9zu%-10zu%-9zu%-10s\n",
+             count_mode_name(modes[m]), pinned ? "yes" : "no", best,
+             corpus.num_words / best / 1e6, base / best, stats.remote_tasks,
+             stats.node_switches, stats.cross_node_merges, pages);
+    }
+  }
+
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Builds a table of num_words distinct words with malloc and with arenas,
+// and compares allocation counts and the time delete_table takes.
+static int bench_teardown(const bench_params_t *p) {
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->num_words, 0, 0);
+  // Every word exactly once, so each one becomes an entry.
+  memcpy(corpus.words, corpus.vocab, p->num_words * sizeof(word_t));
+
+  printf("# %zu distinct words, best of %d\n", p->num_words, p->repeats);
+  printf("%-8s%-12s%-12s%-12s%-12s%-12s%-10s\n", "alloc", "build_s",
+         "teardown_s", "mallocs", "frees", "arena", "slabs");
+
+  for (int arena = 0; arena <= 1; arena++) {
+    set_arena_enabled(arena);
+    double best_build = 0, best_teardown = 0;
+    alloc_stats_t stats;
+    size_t slabs = 0;
+
+    for (int r = 0; r < p->repeats; r++) {
+      reset_alloc_stats();
+
+      double start = now_sec();
+      count_map_t map = count_words_seq(corpus.words, corpus.num_words);
+      double built = now_sec();
+      if (check_map(map, &corpus) == -1) {
+        fprintf(stderr, "wrong total\n");
+        return 1;
+      }
+      if (arena) {
+        slabs = arena_of(map)->num_slabs;
+      }
+      double mid = now_sec();
+      delete_table(map);
+      double end = now_sec();
+
+      // Allocations of one run, teardown included.
+      get_alloc_stats(&stats);
+      if (r == 0 || built - start < best_build) {
+        best_build = built - start;
+      }
+      if (r == 0 || end - mid < best_teardown) {
+        best_teardown = end - mid;
+      }
+    }
+
+    printf("%-8s%-12.4f%-12.4f%-12zu%-12zu%-12zu%-10zu\n",
+           arena ? "arena" : "malloc", best_build, best_teardown,
+           stats.mallocs, stats.frees, stats.arena_allocs, slabs);
+  }
+  set_arena_enabled(0);
+
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Times word_table_find on the compiled-in backend, for words that are in the
+// table and for words that are not. Hashes are computed up front so only the
+// table itself is measured.
+static int bench_lookup(const bench_params_t *p) {
+  corpus_t corpus, misses;
+  corpus_init(&corpus, p->num_words, p->vocab_size, p->skew, 42);
+  corpus_init(&misses, p->num_words, p->vocab_size, p->skew, 7);
+  // Same shapes, different words: prefix the miss vocabulary with 'x'.
+  for (size_t i = 0; i < misses.vocab_size; i++) {
+    ((char *)misses.vocab[i])[0] = 'x';
+  }
+
+  token_t *hits = malloc(p->num_words * sizeof(token_t));
+  token_t *miss_tokens = malloc(p->num_words * sizeof(token_t));
+  intern_words(corpus.words, p->num_words, hits);
+  intern_words(misses.words, p->num_words, miss_tokens);
+
+  word_table_t table;
+  word_table_init(&table);
+  double start = now_sec();
+  for (size_t i = 0; i < corpus.vocab_size; i++) {
+    size_t len = strlen(corpus.vocab[i]);
+    word_table_add(&table, corpus.vocab[i], len,
+                   hash_word(corpus.vocab[i], len));
+  }
+  double insert = now_sec() - start;
+
+  double best_hit = 0, best_miss = 0;
+  size_t found = 0;
+  for (int r = 0; r < p->repeats; r++) {
+    found = 0;
+    start = now_sec();
+    for (size_t i = 0; i < p->num_words; i++) {
+      found += word_table_find(&table, hits[i].word, hits[i].len,
+                               hits[i].hash) != NULL;
+    }
+    double hit = now_sec() - start;
+
+    start = now_sec();
+    for (size_t i = 0; i < p->num_words; i++) {
+      found += word_table_find(&table, miss_tokens[i].word,
+                               miss_tokens[i].len,
+                               miss_tokens[i].hash) != NULL;
+    }
+    double miss = now_sec() - start;
+
+    if (r == 0 || hit < best_hit) {
+      best_hit = hit;
+    }
+    if (r == 0 || miss < best_miss) {
+      best_miss = miss;
+    }
+  }
+  if (found != p->num_words) {
+    fprintf(stderr, "lookup: found %zu of %zu words\n", found, p->num_words);
+    return 1;
+  }
+
+  printf("# backend %s, %zu distinct words, %zu lookups, best of %d\n",
+         word_table_backend(), corpus.vocab_size, p->num_words, p->repeats);
+  printf("%-10s%-12s%-12s\n", "op", "seconds", "Mops/s");
+  printf("%-10s%-12.4f%-12.2f\n", "insert", insert,
+         corpus.vocab_size / insert / 1e6);
+  printf("%-10s%-12.4f%-12.2f\n", "hit", best_hit,
+         p->num_words / best_hit / 1e6);
+  printf("%-10s%-12.4f%-12.2f\n", "miss", best_miss,
+         p->num_words / best_miss / 1e6);
+
+  word_table_destroy(&table);
+  free(miss_tokens);
+  free(hits);
+  corpus_free(&misses);
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Counts the corpus the way the original lab did, with HASH_FIND_STR and
+// HASH_ADD_KEYPTR hashing the word on every call, and with interned tokens
+// that are hashed once. The hash time of the first is measured separately by
+// repeating exactly its hash computations.
+static int bench_hash(const bench_params_t *p) {
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->vocab_size, p->skew, 42);
+
+  printf("# %zu words, %zu distinct, best of %d\n", p->num_words,
+         p->vocab_size, p->repeats);
+  printf("%-10s%-12s%-12s%-12s%-12s\n", "keys", "hashes", "hash_s", "total_s",
+         "Mwords/s");
+
+  double best_hash = 0, best_total = 0;
+  size_t hashes = 0;
+  for (int r = 0; r < p->repeats; r++) {
+    count_map_t map = NULL;
+    size_t added = 0;
+
+    double start = now_sec();
+    for (size_t i = 0; i < p->num_words; i++) {
+      word_count_entry_t *w = NULL;
+      HASH_FIND_STR(map, corpus.words[i], w);
+      if (w) {
+        w->count++;
+      } else {
+        w = create_entry(corpus.words[i], 1);
+        HASH_ADD_KEYPTR(hh, map, w->word, strlen(w->word), w);
+        added++;
+      }
+    }
+    double total = now_sec() - start;
+    if (check_map(map, &corpus) == -1) {
+      fprintf(stderr, "hash: wrong total\n");
+      return 1;
+    }
+    delete_table(map);
+
+    // One strlen and hash per lookup, and another per insertion.
+    volatile unsigned sink = 0;
+    start = now_sec();
+    for (size_t i = 0; i < p->num_words; i++) {
+      sink ^= hash_word(corpus.words[i], strlen(corpus.words[i]));
+    }
+    for (size_t i = 0; i < added; i++) {
+      sink ^= hash_word(corpus.vocab[i % p->vocab_size],
+                        strlen(corpus.vocab[i % p->vocab_size]));
+    }
+    double hash = now_sec() - start;
+
+    hashes = p->num_words + added;
+    if (r == 0 || total < best_total) {
+      best_total = total;
+    }
+    if (r == 0 || hash < best_hash) {
+      best_hash = hash;
+    }
+  }
+  printf("%-10s%-12zu%-12.4f%-12.4f%-12.2f\n", "string", hashes, best_hash,
+         best_total, p->num_words / best_total / 1e6);
+
+  token_t *tokens = malloc(p->num_words * sizeof(token_t));
+  for (int r = 0; r < p->repeats; r++) {
+    count_map_t map = NULL;
+
+    double start = now_sec();
+    intern_words(corpus.words, p->num_words, tokens);
+    double hash = now_sec() - start;
+    for (size_t i = 0; i < p->num_words; i++) {
+      const token_t *t = &tokens[i];
+      word_count_entry_t *w = NULL;
+      HASH_FIND_BYHASHVALUE(hh, map, t->word, t->len, t->hash, w);
+      if (w) {
+        w->count++;
+      } else {
+        w = create_entry(t->word, 1);
+        HASH_ADD_KEYPTR_BYHASHVALUE(hh, map, w->word, t->len, t->hash, w);
+      }
+    }
+    double total = now_sec() - start;
+    if (check_map(map, &corpus) == -1) {
+      fprintf(stderr, "hash: wrong total\n");
+      return 1;
+    }
+    delete_table(map);
+
+    if (r == 0 || total < best_total) {
+      best_total = total;
+    }
+    if (r == 0 || hash < best_hash) {
+      best_hash = hash;
+    }
+  }
+  printf("%-10s%-12zu%-12.4f%-12.4f%-12.2f\n", "interned", p->num_words,
+         best_hash, best_total, p->num_words / best_total / 1e6);
+
+  free(tokens);
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Looks up num_words words in a table of vocab_size words, at several miss
+// rates, with uthash's bloom filter off and on. Misses are words of the same
+// shape that are not in the table, like the long tail of words a corpus only
+// uses once.
+static int bench_bloom(const bench_params_t *p) {
+  const unsigned miss_percent[] = {0, 50, 90, 99};
+  corpus_t corpus, misses;
+  corpus_init(&corpus, p->num_words, p->vocab_size, p->skew, 42);
+  corpus_init(&misses, p->num_words, p->vocab_size, p->skew, 7);
+  for (size_t i = 0; i < misses.vocab_size; i++) {
+    ((char *)misses.vocab[i])[0] = 'x';
+  }
+
+  token_t *keys = malloc(p->vocab_size * sizeof(token_t));
+  token_t *hits = malloc(p->num_words * sizeof(token_t));
+  token_t *miss_tokens = malloc(p->num_words * sizeof(token_t));
+  token_t *queries = malloc(p->num_words * sizeof(token_t));
+  intern_words(corpus.vocab, p->vocab_size, keys);
+  intern_words(corpus.words, p->num_words, hits);
+  intern_words(misses.words, p->num_words, miss_tokens);
+
+  printf("# %zu keys, %zu lookups, best of %d\n", p->vocab_size, p->num_words,
+         p->repeats);
+  printf("%-8s%-6s%-10s%-10s%-12s%-10s\n", "filter", "bits", "miss_rate",
+         "fp_rate", "Mlookups/s", "speedup");
+
+  for (size_t m = 0; m < sizeof(miss_percent) / sizeof(miss_percent[0]);
+       m++) {
+    uint64_t state = 1;
+    for (size_t i = 0; i < p->num_words; i++) {
+      int miss = xorshift64(&state) % 100 < miss_percent[m];
+      queries[i] = miss ? miss_tokens[i] : hits[i];
+    }
+
+    bloom_probe_result_t off, on;
+    bloom_probe_off(keys, p->vocab_size, queries, p->num_words, p->repeats,
+                    &off);
+    bloom_probe_on(keys, p->vocab_size, queries, p->num_words, p->repeats,
+                   &on);
+    if (off.hits != on.hits) {
+      fprintf(stderr, "bloom: %zu hits with the filter, %zu without\n",
+              on.hits, off.hits);
+      return 1;
+    }
+
+    double miss_rate = (double)off.misses / p->num_words;
+    printf("%-8s%-6s%-10.3f%-10s%-12.2f%-10.2f\n", "off", "-", miss_rate, "-",
+           p->num_words / off.seconds / 1e6, 1.0);
+    printf("%-8s%-6u%-10.3f%-10.4f%-12.2f%-10.2f\n", "on", on.bloom_bits,
+           miss_rate,
+           on.misses ? (double)on.false_positives / on.misses : 0.0,
+           p->num_words / on.seconds / 1e6, off.seconds / on.seconds);
+  }
+
+  free(queries);
+  free(miss_tokens);
+  free(hits);
+  free(keys);
+  corpus_free(&misses);
+  corpus_free(&corpus);
+  return 0;
+}
+
+// Orders a table of num_words distinct words with HASH_SORT, with the
+// parallel sort at 1, 2, 4, ... max_threads threads, and with top-k selection.
+static int bench_sort(const bench_params_t *p) {
+  const size_t k = 10;
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->num_words, 0, 0);
+  memcpy(corpus.words, corpus.vocab, p->num_words * sizeof(word_t));
+
+  count_map_t map = count_words_seq(corpus.words, corpus.num_words);
+  // Spread the counts so top-k has something to select.
+  uint64_t state = 42;
+  word_count_entry_t *current, *tmp;
+  HASH_ITER(hh, map, current, tmp) {
+    current->count = xorshift64(&state) % 1000;
+  }
+
+  printf("# %zu distinct words, best of %d\n", p->num_words, p->repeats);
+  printf("%-12s%-8s%-12s%-10s\n", "method", "threads", "seconds", "speedup");
+
+  double base = 0;
+  for (int r = 0; r < p->repeats; r++) {
+    double start = now_sec();
+    HASH_SORT(map, sort_func);
+    double elapsed = now_sec() - start;
+    if (r == 0 || elapsed < base) {
+      base = elapsed;
+    }
+  }
+  printf("%-12s%-8d%-12.4f%-10.2f\n", "HASH_SORT", 1, base, 1.0);
+
+  for (size_t threads = 1; threads <= p->max_threads; threads *= 2) {
+    double best = 0;
+    for (int r = 0; r < p->repeats; r++) {
+      size_t count;
+      double start = now_sec();
+      word_count_entry_t **entries =
+          sort_entries_parallel(map, threads, &count);
+      double elapsed = now_sec() - start;
+
+      // The map is in HASH_SORT order, which the array must reproduce.
+      size_t i = 0;
+      HASH_ITER(hh, map, current, tmp) {
+        if (i >= count || entries[i++] != current) {
+          fprintf(stderr, "sort: order differs with %zu threads\n", threads);
+          return 1;
+        }
+      }
+      free(entries);
+
+      if (r == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    printf("%-12s%-8zu%-12.4f%-10.2f\n", "parallel", threads, best,
+           base / best);
+  }
+
+  double best = 0;
+  for (int r = 0; r < p->repeats; r++) {
+    size_t count;
+    double start = now_sec();
+    word_count_entry_t **entries =
+        top_k_entries(map, k, p->max_threads, &count);
+    double elapsed = now_sec() - start;
+    free(entries);
+    if (r == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf("top-%-8zu%-8zu%-12.4f%-10.2f\n", k, p->max_threads, best,
+         base / best);
+
+  delete_table(map);
+  corpus_free(&corpus);
+  return 0;
+}
+
+typedef struct {
+  token_t *tokens;
+  size_t count;
+  size_t capacity;
+} token_list_t;
+
+static void collect_tokens(void *ctx, token_t *tokens, size_t num_tokens) {
+  token_list_t *list = (token_list_t *)ctx;
+  if (list->count + num_tokens > list->capacity) {
+    list->capacity = (list->capacity + num_tokens) * 2;
+    list->tokens = realloc(list->tokens, list->capacity * sizeof(token_t));
+  }
+  memcpy(list->tokens + list->count, tokens, num_tokens * sizeof(token_t));
+  list->count += num_tokens;
+}
+
+// Reads every word of the benchmark files, or of a synthetic corpus if no
+// files were given. The files stay mapped until free_words().
+static int load_words(const bench_params_t *p, corpus_t *corpus,
+                      mapped_file_t *files, token_list_t *list) {
+  list->tokens = NULL;
+  list->count = list->capacity = 0;
+
+  if (p->num_files == 0) {
+    corpus_init(corpus, p->num_words, p->vocab_size, p->skew, 42);
+    list->tokens = malloc(p->num_words * sizeof(token_t));
+    list->count = list->capacity = p->num_words;
+    intern_words(corpus->words, p->num_words, list->tokens);
+    return 0;
+  }
+
+  for (size_t i = 0; i < p->num_files; i++) {
+    if (map_file(p->files[i], &files[i]) == -1) {
+      fprintf(stderr, "%s: %s\n", p->files[i], strerror(errno));
+      return -1;
+    }
+  }
+  text_span_t *spans;
+  size_t num_spans =
+      split_spans(files, p->num_files, TOKENIZE_SPAN_SIZE, &spans);
+  for (size_t i = 0; i < num_spans; i++) {
+    tokenize_span(&spans[i], collect_tokens, list);
+  }
+  free(spans);
+  return 0;
+}
+
+static void free_words(const bench_params_t *p, corpus_t *corpus,
+                       mapped_file_t *files, token_list_t *list) {
+  if (p->num_files == 0) {
+    corpus_free(corpus);
+  }
+  for (size_t i = 0; i < p->num_files; i++) {
+    unmap_file(&files[i]);
+  }
+  free(list->tokens);
+}
+
+// Compares every hash of word_hashes[] on the same words: raw hashing speed,
+// and how evenly a uthash table keyed by that hash spreads the distinct words
+// over its buckets. uthash doubles the bucket array whenever a chain grows
+// past its ideal length, so a weak hash shows up as a high max chain, many
+// nonideal items and sometimes ineffective expansions.
+static int bench_hashfn(const bench_params_t *p) {
+  corpus_t corpus;
+  mapped_file_t *files = calloc(p->num_files, sizeof(mapped_file_t));
+  token_list_t list;
+  if (load_words(p, &corpus, files, &list) == -1) {
+    return 1;
+  }
+
+  size_t bytes = 0;
+  for (size_t i = 0; i < list.count; i++) {
+    bytes += list.tokens[i].len;
+  }
+
+  printf("# %zu words, %.1f MB, from %s, best of %d, compiled-in %s\n",
+         list.count, bytes / 1e6, p->num_files ? "files" : "synthetic corpus",
+         p->repeats, LAB8_HASH_NAME);
+  printf("%-8s%-10s%-10s%-10s%-10s%-10s%-10s%-10s%-6s\n", "hash", "Mhash/s",
+         "MB/s", "distinct", "buckets", "max_chain", "ideal_max", "nonideal",
+         "ineff");
+
+  for (size_t h = 0; h < num_word_hashes; h++) {
+    word_hash_fn_t fn = word_hashes[h].fn;
+
+    double best = 0;
+    for (int r = 0; r < p->repeats; r++) {
+      volatile unsigned sink = 0;
+      double start = now_sec();
+      for (size_t i = 0; i < list.count; i++) {
+        sink ^= fn(list.tokens[i].word, list.tokens[i].len);
+      }
+      double elapsed = now_sec() - start;
+      if (r == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+
+    count_map_t map = NULL;
+    for (size_t i = 0; i < list.count; i++) {
+      const token_t *t = &list.tokens[i];
+      unsigned hashv = fn(t->word, t->len);
+      word_count_entry_t *w = NULL;
+      HASH_FIND_BYHASHVALUE(hh, map, t->word, t->len, hashv, w);
+      if (w) {
+        w->count++;
+      } else {
+        w = create_entry(t->word, 1);
+        HASH_ADD_KEYPTR_BYHASHVALUE(hh, map, w->word, t->len, hashv, w);
+      }
+    }
+
+    UT_hash_table *tbl = map ? map->hh.tbl : NULL;
+    unsigned max_chain = 0;
+    for (unsigned b = 0; tbl && b < tbl->num_buckets; b++) {
+      if (tbl->buckets[b].count > max_chain) {
+        max_chain = tbl->buckets[b].count;
+      }
+    }
+    printf("%-8s%-10.1f%-10.1f%-10u%-10u%-10u%-10u%-10u%-6u\n",
+           word_hashes[h].name, list.count / best / 1e6, bytes / best / 1e6,
+           HASH_COUNT(map), tbl ? tbl->num_buckets : 0, max_chain,
+           tbl ? tbl->ideal_chain_maxlen : 0, tbl ? tbl->nonideal_items : 0,
+           tbl ? tbl->ineff_expands : 0);
+    delete_table(map);
+  }
+
+  free_words(p, &corpus, files, &list);
+  free(files);
+  return 0;
+}
+
+// Writes a sorted table of num_words distinct words to /dev/null with printf,
+// as print_entries does, and with each format of write_entries. Only the
+// formatting and the system calls are measured, not a real sink.
+static int bench_output(const bench_params_t *p) {
+  const output_format_t formats[] = {OUTPUT_TEXT, OUTPUT_TSV, OUTPUT_BINARY};
+  const char *format_names[] = {"text", "tsv", "binary"};
+  corpus_t corpus;
+  corpus_init(&corpus, p->num_words, p->num_words, 0, 0);
+  memcpy(corpus.words, corpus.vocab, p->num_words * sizeof(word_t));
+
+  count_map_t map = count_words_seq(corpus.words, corpus.num_words);
+  uint64_t state = 42;
+  word_count_entry_t *current, *tmp;
+  HASH_ITER(hh, map, current, tmp) {
+    current->count = xorshift64(&state) % 100000;
+  }
+  size_t count;
+  word_count_entry_t **entries = sort_entries_parallel(map, 1, &count);
+
+  int fd = open("/dev/null", O_WRONLY);
+  FILE *null_file = fdopen(dup(fd), "w");
+  char *buf = malloc(OUTPUT_BUFFER_SIZE);
+  if (fd == -1 || !null_file || !buf) {
+    perror("/dev/null");
+    return 1;
+  }
+
+  printf("# %zu entries, best of %d\n", count, p->repeats);
+  printf("%-10s%-10s%-10s%-10s%-10s%-10s\n", "format", "seconds", "MB",
+         "MB/s", "writes", "speedup");
+
+  double base = 0;
+  size_t text_bytes = 0;
+  for (int r = 0; r < p->repeats; r++) {
+    double start = now_sec();
+    size_t bytes = fprintf(null_file, "%-32s%-10s\n", "Word", "Count");
+    for (size_t i = 0; i < count; i++) {
+      bytes += fprintf(null_file, "%-32.*s%-10zu\n",
+                       (int)entries[i]->hh.keylen, entries[i]->word,
+                       entries[i]->count);
+    }
+    fflush(null_file);
+    double elapsed = now_sec() - start;
+    if (r == 0 || elapsed < base) {
+      base = elapsed;
+    }
+    text_bytes = bytes;
+  }
+  printf("%-10s%-10.4f%-10.1f%-10.1f%-10s%-10.2f\n", "printf", base,
+         text_bytes / 1e6, text_bytes / base / 1e6, "-", 1.0);
+
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    double best = 0;
+    out_buf_t out;
+    for (int r = 0; r < p->repeats; r++) {
+      out_buf_init(&out, fd, buf, OUTPUT_BUFFER_SIZE);
+      double start = now_sec();
+      if (write_entries(&out, entries, count, formats[f]) == -1) {
+        perror("write_entries");
+        return 1;
+      }
+      double elapsed = now_sec() - start;
+      if (r == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    // The text format must match printf byte for byte, so at least the
+    // lengths have to agree.
+    if (formats[f] == OUTPUT_TEXT && out.bytes_written != text_bytes) {
+      fprintf(stderr, "output: text is %zu bytes, printf %zu\n",
+              out.bytes_written, text_bytes);
+      return 1;
+    }
+    printf("%-10s%-10.4f%-10.1f%-10.1f%-10zu%-10.2f\n", format_names[f], best,
+           out.bytes_written / 1e6, out.bytes_written / best / 1e6,
+           out.num_writes, base / best);
+  }
+
+  fclose(null_file);
+  close(fd);
+  free(buf);
+  free(entries);
+  delete_table(map);
+  corpus_free(&corpus);
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [scaling|contention|zipf|numa|batch|teardown|lookup|"
+          "hash|hashfn|bloom|sort|output] [-n num_words] [-v vocab_size] "
+          "[-z skew] [-t max_threads] [-r repeats] [-c chunk_size] "
+          "[file...]\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = "scaling";
+  if (argc > 1 && argv[1][0] != '-') {
+    name = argv[1];
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+  }
+
+  bench_params_t p = {
+      .num_words = 0,
+      .vocab_size = 0,
+      .skew = 0,
+      .max_threads = 0,
+      .chunk_size = 0,
+      .repeats = 3,
+      .files = NULL,
+      .num_files = 0,
+  };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:v:z:t:r:c:")) != -1) {
+    switch (opt) {
+    case 'n':
+      p.num_words = strtoull(optarg, NULL, 10);
+      break;
+    case 'v':
+      p.vocab_size = strtoull(optarg, NULL, 10);
+      break;
+    case 'z':
+      p.skew = strtod(optarg, NULL);
+      break;
+    case 't':
+      p.max_threads = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      p.repeats = atoi(optarg);
+      break;
+    case 'c':
+      p.chunk_size = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (p.repeats < 1 || p.skew < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  p.files = argv + optind;
+  p.num_files = argc - optind;
+
+  if (strcmp(name, "contention") == 0) {
+    p.num_words = p.num_words ? p.num_words : 4000000;
+    p.vocab_size = p.vocab_size ? p.vocab_size : 64;
+    p.max_threads = p.max_threads ? p.max_threads : 32;
+    return bench_scaling(&p);
+  }
+  if (strcmp(name, "zipf") == 0) {
+    p.num_words = p.num_words ? p.num_words : 2000000;
+    p.vocab_size = p.vocab_size ? p.vocab_size : 100000;
+    p.max_threads = p.max_threads ? p.max_threads : 8;
+    return bench_zipf(&p);
+  }
+  p.vocab_size = p.vocab_size ? p.vocab_size : 10000;
+  p.max_threads = p.max_threads ? p.max_threads : 8;
+
+  if (strcmp(name, "scaling") == 0) {
+    p.num_words = p.num_words ? p.num_words : 1000000;
+    return bench_scaling(&p);
+  }
+  if (strcmp(name, "batch") == 0) {
+    p.num_words = p.num_words ? p.num_words : 2000000;
+    return bench_batch(&p);
+  }
+  if (strcmp(name, "numa") == 0) {
+    p.num_words = p.num_words ? p.num_words : 4000000;
+    return bench_numa(&p);
+  }
+  if (strcmp(name, "teardown") == 0) {
+    p.num_words = p.num_words ? p.num_words : 2000000;
+    return bench_teardown(&p);
+  }
+
+  if (strcmp(name, "lookup") == 0) {
+    p.num_words = p.num_words ? p.num_words : 5000000;
+    return bench_lookup(&p);
+  }
+  if (strcmp(name, "hash") == 0) {
+    p.num_words = p.num_words ? p.num_words : 5000000;
+    return bench_hash(&p);
+  }
+  if (strcmp(name, "hashfn") == 0) {
+    p.num_words = p.num_words ? p.num_words : 5000000;
+    return bench_hashfn(&p);
+  }
+  if (strcmp(name, "bloom") == 0) {
+    p.num_words = p.num_words ? p.num_words : 5000000;
+    return bench_bloom(&p);
+  }
+  if (strcmp(name, "sort") == 0) {
+    p.num_words = p.num_words ? p.num_words : 1000000;
+    return bench_sort(&p);
+  }
+  if (strcmp(name, "output") == 0) {
+    p.num_words = p.num_words ? p.num_words : 2000000;
+    return bench_output(&p);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
@@ -0,0 +1,72 @@
+// Lab 8 - Miss-heavy uthash lookups with and without HASH_BLOOM
+// Built twice by CMake, with BLOOM_PROBE naming the function to define and
+// HASH_BLOOM set only for bloom_probe_on.
+#include "bloom_probe.h"
+#include "uthash.h"
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef BLOOM_PROBE
+#error "BLOOM_PROBE must name the function to build"
+#endif
+
+typedef struct {
+  const char *word;
+  UT_hash_handle hh;
+} probe_entry_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void BLOOM_PROBE(const token_t *keys, size_t num_keys, const token_t *queries,
+                 size_t num_queries, int repeats,
+                 bloom_probe_result_t *result) {
+  probe_entry_t *map = NULL;
+  probe_entry_t *entries = malloc(num_keys * sizeof(probe_entry_t));
+  for (size_t i = 0; i < num_keys; i++) {
+    entries[i].word = keys[i].word;
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, map, entries[i].word, keys[i].len,
+                                keys[i].hash, &entries[i]);
+  }
+
+  result->hits = result->misses = result->false_positives = 0;
+  for (size_t i = 0; map && i < num_queries; i++) {
+    probe_entry_t *e = NULL;
+    HASH_FIND_BYHASHVALUE(hh, map, queries[i].word, queries[i].len,
+                          queries[i].hash, e);
+    if (e) {
+      result->hits++;
+      continue;
+    }
+    result->misses++;
+#ifdef HASH_BLOOM
+    result->false_positives += HASH_BLOOM_TEST(map->hh.tbl, queries[i].hash);
+#endif
+  }
+#ifdef HASH_BLOOM
+  result->bloom_bits = HASH_BLOOM;
+#else
+  result->bloom_bits = 0;
+#endif
+
+  volatile size_t found = 0;
+  for (int r = 0; r < repeats; r++) {
+    double start = now_sec();
+    for (size_t i = 0; i < num_queries; i++) {
+      probe_entry_t *e = NULL;
+      HASH_FIND_BYHASHVALUE(hh, map, queries[i].word, queries[i].len,
+                            queries[i].hash, e);
+      found += e != NULL;
+    }
+    double elapsed = now_sec() - start;
+    if (r == 0 || elapsed < result->seconds) {
+      result->seconds = elapsed;
+    }
+  }
+
+  HASH_CLEAR(hh, map);
+  free(entries);
+}
@@ -0,0 +1,74 @@
+// Lab 8 - Lock-free chained word count map shared by all workers
+#include "concurrent_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void concurrent_map_init(concurrent_map_t *map, size_t expected_words,
+                         size_t num_workers) {
+  size_t log2 = CMAP_MIN_BUCKETS_LOG2;
+  while (log2 < CMAP_MAX_BUCKETS_LOG2 &&
+         ((size_t)1 << log2) < expected_words) {
+    log2++;
+  }
+
+  map->buckets = calloc((size_t)1 << log2, sizeof(*map->buckets));
+  map->arenas = malloc(num_workers * sizeof(arena_t *));
+  if (!map->buckets || !map->arenas) {
+    perror("concurrent_map");
+    exit(EXIT_FAILURE);
+  }
+  map->mask = ((size_t)1 << log2) - 1;
+  for (size_t i = 0; i < num_workers; i++) {
+    map->arenas[i] = arena_create();
+  }
+  map->num_workers = num_workers;
+}
+
+void concurrent_map_add(concurrent_map_t *map, size_t worker, const char *word,
+                        size_t len, uint32_t hash) {
+  _Atomic(cmap_node_t *) *bucket = &map->buckets[hash & map->mask];
+  // Acquire pairs with the release CAS that published head, so its fields
+  // and everything behind it are visible.
+  cmap_node_t *head = atomic_load_explicit(bucket, memory_order_acquire);
+  cmap_node_t *checked = NULL; // nodes from here on were already compared
+  cmap_node_t *node = NULL;
+
+  for (;;) {
+    for (cmap_node_t *n = head; n != checked; n = n->next) {
+      if (n->hash == hash && n->len == len && memcmp(n->word, word, len) == 0) {
+        atomic_fetch_add_explicit(&n->count, 1, memory_order_relaxed);
+        // A node prepared for a lost race stays unused in the arena.
+        return;
+      }
+    }
+
+    if (!node) {
+      node = arena_alloc(map->arenas[worker], sizeof(cmap_node_t));
+      node->word = word;
+      node->len = (uint32_t)len;
+      node->hash = hash;
+      atomic_init(&node->count, 1);
+    }
+    node->next = head;
+    if (atomic_compare_exchange_weak_explicit(bucket, &head, node,
+                                              memory_order_release,
+                                              memory_order_acquire)) {
+      return;
+    }
+    // Someone else pushed first: only the nodes in front of our old head are
+    // new, and one of them may be this word.
+    checked = node->next;
+  }
+}
+
+void concurrent_map_destroy(concurrent_map_t *map) {
+  for (size_t i = 0; i < map->num_workers; i++) {
+    arena_release(map->arenas[i]);
+  }
+  free(map->arenas);
+  free(map->buckets);
+  map->arenas = NULL;
+  map->buckets = NULL;
+  map->num_workers = 0;
+}
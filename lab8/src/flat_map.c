@@ -0,0 +1,176 @@
+// Lab 8 - Open-addressing word count table probed 16 slots at a time
+#include "flat_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FLAT_INITIAL_CAPACITY 64
+
+// The hash feeds both the group position and the tag. Spread it over 64 bits
+// first so the two use independent bits; callers such as the sharded map
+// already consume some of the raw hash bits.
+static inline uint64_t mix(uint32_t hash) {
+  return (uint64_t)hash * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline uint8_t tag_of(uint64_t mixed) {
+  return (uint8_t)((mixed >> 25) & 0x7f);
+}
+
+static inline size_t first_group(const flat_map_t *map, uint64_t mixed) {
+  size_t slot = (size_t)(mixed >> 32) & (map->capacity - 1);
+  return slot & ~(size_t)(FLAT_GROUP_SIZE - 1);
+}
+
+// Bit i of the result is set when tags[group + i] == tag.
+static inline unsigned match_tag(const uint8_t *group, uint8_t tag) {
+#ifdef __SSE2__
+  __m128i tags = _mm_load_si128((const __m128i *)group);
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(tag)));
+#else
+  unsigned mask = 0;
+  for (unsigned i = 0; i < FLAT_GROUP_SIZE; i++) {
+    mask |= (unsigned)(group[i] == tag) << i;
+  }
+  return mask;
+#endif
+}
+
+// Bit i of the result is set when slot group + i is empty.
+static inline unsigned match_empty(const uint8_t *group) {
+#ifdef __SSE2__
+  return (unsigned)_mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+  return match_tag(group, FLAT_EMPTY);
+#endif
+}
+
+static void alloc_arrays(flat_map_t *map, size_t capacity) {
+  map->tags = aligned_alloc(FLAT_GROUP_SIZE, capacity);
+  map->slots = malloc(capacity * sizeof(flat_slot_t));
+  if (!map->tags || !map->slots) {
+    perror("flat_map");
+    exit(EXIT_FAILURE);
+  }
+  memset(map->tags, FLAT_EMPTY, capacity);
+  map->capacity = capacity;
+  map->size = 0;
+}
+
+void flat_map_init(flat_map_t *map) {
+  alloc_arrays(map, FLAT_INITIAL_CAPACITY);
+}
+
+void flat_map_destroy(flat_map_t *map) {
+  free(map->tags);
+  free(map->slots);
+  map->tags = NULL;
+  map->slots = NULL;
+  map->capacity = 0;
+  map->size = 0;
+}
+
+// Visits groups in triangular order (+1, +2, +3, ... groups), which reaches
+// every group of a power-of-two table. Returns the slot holding word, or the
+// empty slot where it belongs if it is absent.
+static size_t probe(const flat_map_t *map, const char *word, size_t len,
+                    uint32_t hash, int *found) {
+  uint64_t mixed = mix(hash);
+  uint8_t tag = tag_of(mixed);
+  size_t group = first_group(map, mixed);
+
+  for (size_t step = FLAT_GROUP_SIZE;; step += FLAT_GROUP_SIZE) {
+    const uint8_t *tags = map->tags + group;
+
+    unsigned match = match_tag(tags, tag);
+    while (match) {
+      size_t i = group + (size_t)__builtin_ctz(match);
+      const flat_slot_t *slot = &map->slots[i];
+      if (slot->hash == hash && slot->len == len &&
+          memcmp(slot->word, word, len) == 0) {
+        *found = 1;
+        return i;
+      }
+      match &= match - 1;
+    }
+
+    unsigned empty = match_empty(tags);
+    if (empty) {
+      *found = 0;
+      return group + (size_t)__builtin_ctz(empty);
+    }
+
+    group = (group + step) & (map->capacity - 1);
+  }
+}
+
+static void grow(flat_map_t *map) {
+  flat_map_t old = *map;
+  alloc_arrays(map, old.capacity * 2);
+
+  for (size_t i = 0; i < old.capacity; i++) {
+    if (old.tags[i] & FLAT_EMPTY) {
+      continue;
+    }
+    const flat_slot_t *slot = &old.slots[i];
+    int found;
+    size_t j = probe(map, slot->word, slot->len, slot->hash, &found);
+    map->tags[j] = old.tags[i];
+    map->slots[j] = *slot;
+    map->size++;
+  }
+
+  free(old.tags);
+  free(old.slots);
+}
+
+size_t *flat_map_find(const flat_map_t *map, const char *word, size_t len,
+                      uint32_t hash) {
+  int found;
+  size_t i = probe(map, word, len, hash, &found);
+  return found ? &map->slots[i].count : NULL;
+}
+
+void flat_map_add(flat_map_t *map, const char *word, size_t len, uint32_t hash,
+                  size_t n) {
+  int found;
+  size_t i = probe(map, word, len, hash, &found);
+  if (found) {
+    map->slots[i].count += n;
+    return;
+  }
+
+  // Keep at least 1/8 of the slots empty so every probe terminates quickly.
+  if ((map->size + 1) * 8 > map->capacity * 7) {
+    grow(map);
+    i = probe(map, word, len, hash, &found);
+  }
+
+  map->tags[i] = tag_of(mix(hash));
+  map->slots[i].word = word;
+  map->slots[i].len = (uint32_t)len;
+  map->slots[i].hash = hash;
+  map->slots[i].count = n;
+  map->size++;
+}
+
+void flat_map_merge(flat_map_t *dst, flat_map_t *src) {
+  // Walk the smaller of the two tables.
+  if (dst->size < src->size) {
+    flat_map_t swap = *dst;
+    *dst = *src;
+    *src = swap;
+  }
+
+  for (size_t i = 0; i < src->capacity; i++) {
+    if (!(src->tags[i] & FLAT_EMPTY)) {
+      const flat_slot_t *slot = &src->slots[i];
+      flat_map_add(dst, slot->word, slot->len, slot->hash, slot->count);
+    }
+  }
+
+  flat_map_destroy(src);
+}
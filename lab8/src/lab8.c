@@ -1,59 +1,633 @@
 // Lab 8 - Starting Code for sorting data in threads using uthash
-#include "uthash.h"
+#include "lab8.h"
+#include "arena.h"
+#include "concurrent_map.h"
+#include "numa.h"
+#include "profile.h"
+#include "scheduler.h"
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#define THREAD_COUNT 3
-typedef const char *word_t;
+#include <unistd.h>
 
 typedef struct {
-  word_t word;
-  size_t count;
-  UT_hash_handle hh;
-} word_count_entry_t;
-
-word_count_entry_t *create_entry(word_t, size_t);
-
-typedef word_count_entry_t *count_map_t;
-
-typedef struct {
-  count_map_t *map;
+  word_table_t *table;
   word_t *words;
   size_t num_words;
   pthread_mutex_t *lock;
+  sharded_map_t *shards;
+  concurrent_map_t *cmap;
+  struct word_batch *batch; // set up by the worker itself in batched mode
+  size_t batch_size;        // 0 unless in batched mode
+  profile_worker_t *prof;   // NULL unless profiling
+  arena_t *arena;
+  const text_span_t *spans;
+  task_scheduler_t *sched;
+  size_t worker;
+  size_t chunk_size;
+  int cpu;                  // pinned to this CPU, or -1
+  const int *worker_node;   // planned node of every worker, NULL unless pinned
+  _Atomic int *seen_node;   // node every worker last counted a task on
 } count_thread_args_t;
 
-count_thread_args_t *pack_args(count_map_t *map, word_t *words,
+count_thread_args_t *pack_args(word_table_t *table, word_t *words,
                                size_t num_words, pthread_mutex_t *lock);
 
-static void add_word_counts_in_chunk(count_map_t *map, word_t *words,
+// Set once by set_arena_enabled() before any map is built.
+static int use_arena = 0;
+
+// Arena that entries and uthash tables of the map being modified on this
+// thread come from. NULL whenever arenas are off.
+static _Thread_local arena_t *current_arena = NULL;
+
+static _Atomic size_t stat_mallocs, stat_frees, stat_arena_allocs;
+
+void set_arena_enabled(int enabled) { use_arena = enabled; }
+
+void *word_count_alloc(size_t size) {
+  if (current_arena) {
+    atomic_fetch_add_explicit(&stat_arena_allocs, 1, memory_order_relaxed);
+    return arena_alloc(current_arena, size);
+  }
+  atomic_fetch_add_explicit(&stat_mallocs, 1, memory_order_relaxed);
+  return malloc(size);
+}
+
+void word_count_free(void *ptr, size_t size) {
+  (void)size;
+  // Arena memory is only given back when the whole arena is released.
+  if (use_arena) {
+    return;
+  }
+  atomic_fetch_add_explicit(&stat_frees, 1, memory_order_relaxed);
+  free(ptr);
+}
+
+void get_alloc_stats(alloc_stats_t *stats) {
+  stats->mallocs = atomic_load(&stat_mallocs);
+  stats->frees = atomic_load(&stat_frees);
+  stats->arena_allocs = atomic_load(&stat_arena_allocs);
+}
+
+void reset_alloc_stats(void) {
+  atomic_store(&stat_mallocs, 0);
+  atomic_store(&stat_frees, 0);
+  atomic_store(&stat_arena_allocs, 0);
+}
+
+// Set once by set_lock_stats_enabled(); when off, the count locks cost no
+// clock reads. Workers count into thread_lock_stats and add it to the totals
+// once, when they finish.
+static int track_locks = 0;
+static _Thread_local lock_stats_t thread_lock_stats;
+static _Atomic size_t stat_lock_acquisitions;
+static _Atomic uint64_t stat_lock_wait_ns, stat_lock_hold_ns;
+
+void set_lock_stats_enabled(int enabled) { track_locks = enabled; }
+
+void get_lock_stats(lock_stats_t *stats) {
+  stats->acquisitions = atomic_load(&stat_lock_acquisitions);
+  stats->wait_ns = atomic_load(&stat_lock_wait_ns);
+  stats->hold_ns = atomic_load(&stat_lock_hold_ns);
+}
+
+void reset_lock_stats(void) {
+  atomic_store(&stat_lock_acquisitions, 0);
+  atomic_store(&stat_lock_wait_ns, 0);
+  atomic_store(&stat_lock_hold_ns, 0);
+}
+
+// Takes one of the locks guarding a count table. Returns the time it was
+// taken if lock stats are on, to be passed to unlock_count().
+static uint64_t lock_count(pthread_mutex_t *lock) {
+  if (!track_locks) {
+    pthread_mutex_lock(lock);
+    return 0;
+  }
+
+  uint64_t start = profile_now_ns();
+  pthread_mutex_lock(lock);
+  uint64_t locked_at = profile_now_ns();
+  thread_lock_stats.wait_ns += locked_at - start;
+  return locked_at;
+}
+
+static void unlock_count(pthread_mutex_t *lock, uint64_t locked_at) {
+  if (track_locks) {
+    thread_lock_stats.hold_ns += profile_now_ns() - locked_at;
+    thread_lock_stats.acquisitions++;
+  }
+  pthread_mutex_unlock(lock);
+}
+
+// Adds the calling worker's lock stats to the totals and, when profiling, to
+// its profile slot.
+static void flush_lock_stats(profile_worker_t *prof) {
+  atomic_fetch_add(&stat_lock_acquisitions, thread_lock_stats.acquisitions);
+  atomic_fetch_add(&stat_lock_wait_ns, thread_lock_stats.wait_ns);
+  atomic_fetch_add(&stat_lock_hold_ns, thread_lock_stats.hold_ns);
+  if (prof) {
+    prof->lock_acquisitions = thread_lock_stats.acquisitions;
+    prof->lock_wait_ns = thread_lock_stats.wait_ns;
+    prof->lock_hold_ns = thread_lock_stats.hold_ns;
+  }
+  thread_lock_stats.acquisitions = 0;
+  thread_lock_stats.wait_ns = 0;
+  thread_lock_stats.hold_ns = 0;
+}
+
+// Read once, the first time any count needs it.
+static numa_topology_t topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+static void load_topology(void) {
+  if (numa_topology_load(&topology) == -1) {
+    memset(&topology, 0, sizeof(topology));
+  }
+}
+
+static _Atomic size_t stat_numa_tasks, stat_remote_tasks, stat_node_switches;
+static _Atomic size_t stat_merges, stat_cross_node_merges;
+static _Atomic uint64_t stat_remote_pages;
+
+void get_numa_stats(numa_stats_t *stats) {
+  pthread_once(&topology_once, load_topology);
+  stats->nodes = topology.num_nodes;
+  stats->tasks = atomic_load(&stat_numa_tasks);
+  stats->remote_tasks = atomic_load(&stat_remote_tasks);
+  stats->node_switches = atomic_load(&stat_node_switches);
+  stats->merges = atomic_load(&stat_merges);
+  stats->cross_node_merges = atomic_load(&stat_cross_node_merges);
+  stats->remote_pages = atomic_load(&stat_remote_pages);
+}
+
+void reset_numa_stats(void) {
+  atomic_store(&stat_numa_tasks, 0);
+  atomic_store(&stat_remote_tasks, 0);
+  atomic_store(&stat_node_switches, 0);
+  atomic_store(&stat_merges, 0);
+  atomic_store(&stat_cross_node_merges, 0);
+  atomic_store(&stat_remote_pages, 0);
+}
+
+static arena_t *new_map_arena(void) {
+  return use_arena ? arena_create() : NULL;
+}
+
+// The arena backing a non-empty map, found through its head entry.
+static arena_t *map_arena(count_map_t map) {
+  return use_arena && map ? arena_of(map) : NULL;
+}
+
+// Releases the arena of a map that ended up empty, which map_arena() cannot
+// find any more.
+static void drop_unused_arena(arena_t *arena, int empty) {
+  if (arena && empty) {
+    arena_release(arena);
+  }
+}
+
+unsigned hash_word(const char *word, size_t len) {
+  unsigned hashv;
+  HASH_VALUE(word, len, hashv);
+  return hashv;
+}
+
+void intern_tokens(token_t *tokens, size_t num_tokens) {
+  for (size_t i = 0; i < num_tokens; i++) {
+    tokens[i].hash = hash_word(tokens[i].word, tokens[i].len);
+  }
+}
+
+void intern_words(const word_t *words, size_t num_words, token_t *tokens) {
+  for (size_t i = 0; i < num_words; i++) {
+    tokens[i].word = words[i];
+    tokens[i].len = (uint32_t)strlen(words[i]);
+  }
+  intern_tokens(tokens, num_words);
+}
+
+// The word_table_* functions are what the workers count into. With the uthash
+// backend a table is the count_map_t itself; with LAB8_FLAT_MAP it is a
+// flat_map_t that is turned into a count_map_t once counting is done.
+#ifdef LAB8_FLAT_MAP
+
+const char *word_table_backend(void) { return "flat"; }
+
+void word_table_init(word_table_t *table) { flat_map_init(table); }
+
+void word_table_add_count(word_table_t *table, const char *word, size_t len,
+                          unsigned hashv, size_t n) {
+  flat_map_add(table, word, len, hashv, n);
+}
+
+size_t *word_table_find(word_table_t *table, const char *word, size_t len,
+                        unsigned hashv) {
+  return flat_map_find(table, word, len, hashv);
+}
+
+void word_table_destroy(word_table_t *table) { flat_map_destroy(table); }
+
+static int word_table_empty(const word_table_t *table) {
+  return table->size == 0;
+}
+
+static void word_table_merge(word_table_t *dst, word_table_t *src) {
+  flat_map_merge(dst, src);
+}
+
+// Flat tables live in malloc'd arrays; only the exported entries use arenas.
+static arena_t *new_table_arena(void) { return NULL; }
+
+// Adds an entry to *map for every word of table and destroys the table. The
+// words must not be in *map yet. Entries come from current_arena.
+static void word_table_drain(word_table_t *table, count_map_t *map) {
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->tags[i] & FLAT_EMPTY) {
+      continue;
+    }
+    const flat_slot_t *slot = &table->slots[i];
+    word_count_entry_t *w = create_entry(slot->word, slot->count);
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, *map, w->word, slot->len, slot->hash, w);
+  }
+  flat_map_destroy(table);
+}
+
+static count_map_t word_table_finish(word_table_t *table) {
+  count_map_t map = NULL;
+  arena_t *arena = new_map_arena();
+
+  current_arena = arena;
+  word_table_drain(table, &map);
+  current_arena = NULL;
+
+  drop_unused_arena(arena, map == NULL);
+  return map;
+}
+
+#else
+
+// Finds word in *map by its precomputed hash and adds n to its count, adding a
+// new entry if it is not there yet. The caller holds whatever lock guards
+// *map.
+static void map_add_word(count_map_t *map, const char *word, size_t len,
+                         unsigned hashv, size_t n) {
+  word_count_entry_t *w = NULL;
+  HASH_FIND_BYHASHVALUE(hh, *map, word, len, hashv, w);
+
+  if (w) {
+    w->count += n;
+  } else {
+    w = create_entry(word, n);
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, *map, w->word, len, hashv, w);
+  }
+}
+
+const char *word_table_backend(void) { return "uthash"; }
+
+void word_table_init(word_table_t *table) { *table = NULL; }
+
+void word_table_add_count(word_table_t *table, const char *word, size_t len,
+                          unsigned hashv, size_t n) {
+  map_add_word(table, word, len, hashv, n);
+}
+
+size_t *word_table_find(word_table_t *table, const char *word, size_t len,
+                        unsigned hashv) {
+  word_count_entry_t *w = NULL;
+  HASH_FIND_BYHASHVALUE(hh, *table, word, len, hashv, w);
+  return w ? &w->count : NULL;
+}
+
+void word_table_destroy(word_table_t *table) {
+  delete_table(*table);
+  *table = NULL;
+}
+
+static int word_table_empty(const word_table_t *table) {
+  return *table == NULL;
+}
+
+static void word_table_merge(word_table_t *dst, word_table_t *src) {
+  merge_count_maps(dst, *src);
+  *src = NULL;
+}
+
+static arena_t *new_table_arena(void) { return new_map_arena(); }
+
+// Moves every entry of table into *map. The words must not be in *map yet, so
+// the stored hash can be reused as is.
+static void word_table_drain(word_table_t *table, count_map_t *map) {
+  word_count_entry_t *current, *tmp;
+  HASH_ITER(hh, *table, current, tmp) {
+    unsigned len = current->hh.keylen;
+    unsigned hashv = current->hh.hashv;
+    HASH_DEL(*table, current);
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, *map, current->word, len, hashv, current);
+  }
+}
+
+static count_map_t word_table_finish(word_table_t *table) {
+  count_map_t map = *table;
+  *table = NULL;
+  return map;
+}
+
+#endif
+
+void word_table_add(word_table_t *table, const char *word, size_t len,
+                    unsigned hashv) {
+  word_table_add_count(table, word, len, hashv, 1);
+}
+
+// Counts interned tokens into table, under lock if there is one. The hashes
+// were computed before the lock was taken, which keeps the critical section
+// down to the lookup itself.
+static void add_token_counts(word_table_t *table, const token_t *tokens,
+                             size_t num_tokens, pthread_mutex_t *lock) {
+  for (size_t i = 0; i < num_tokens; i++) {
+    uint64_t locked_at = 0;
+    if (lock)
+      locked_at = lock_count(lock); // lock each pass
+
+    word_table_add(table, tokens[i].word, tokens[i].len, tokens[i].hash);
+
+    if (lock)
+      unlock_count(lock, locked_at); // unlock each pass
+  }
+}
+
+static void add_word_counts_in_chunk(word_table_t *table, word_t *words,
                                      size_t num_words, pthread_mutex_t *lock) {
   // --------- Task 4 --------- \\
   // Make this function thread-safe by using the lock
+  token_t batch[TOKEN_BATCH_SIZE];
 
-  for (size_t i = 0; i < num_words; i++) {
-    if (lock)
-      pthread_mutex_lock(lock); // lock each pass
+  for (size_t i = 0; i < num_words; i += TOKEN_BATCH_SIZE) {
+    size_t n = num_words - i < TOKEN_BATCH_SIZE ? num_words - i
+                                                : TOKEN_BATCH_SIZE;
+    intern_words(words + i, n, batch);
+    add_token_counts(table, batch, n, lock);
+  }
+}
+
+// Counts each token while holding only the lock of the shard its hash falls
+// into. The same hash picks the shard and is used for the lookup.
+static void add_token_counts_sharded(sharded_map_t *shards,
+                                     const token_t *tokens,
+                                     size_t num_tokens) {
+  for (size_t i = 0; i < num_tokens; i++) {
+    // uthash picks buckets from the low bits, so use the high bits here.
+    count_shard_t *shard =
+        &shards->shards[tokens[i].hash >> (32 - SHARD_COUNT_LOG2)];
+    uint64_t locked_at = lock_count(&shard->lock);
+    current_arena = shard->arena;
+    word_table_add(&shard->table, tokens[i].word, tokens[i].len,
+                   tokens[i].hash);
+    unlock_count(&shard->lock, locked_at);
+  }
+}
+
+// Counts tokens into the lock-free map; no lock is taken at all.
+static void add_token_counts_lockfree(concurrent_map_t *cmap, size_t worker,
+                                      const token_t *tokens,
+                                      size_t num_tokens) {
+  for (size_t i = 0; i < num_tokens; i++) {
+    concurrent_map_add(cmap, worker, tokens[i].word, tokens[i].len,
+                       tokens[i].hash);
+  }
+}
 
+// Private buffer of the batched mode. It collects up to batch_size word
+// occurrences, collapsed by word, and then adds them all to the shared table
+// under a single acquisition of its lock.
+typedef struct word_batch {
+  token_t *tokens; // distinct words seen since the last flush
+  size_t *counts;
+  uint32_t *slots; // open-addressing index into tokens + 1, 0 when empty
+  size_t slot_mask;
+  size_t num_distinct;
+  size_t num_words;
+  size_t batch_size;
+} word_batch_t;
+
+static void word_batch_init(word_batch_t *batch, size_t batch_size) {
+  size_t capacity = 16;
+  while (capacity < 2 * batch_size) {
+    capacity *= 2;
+  }
+  batch->tokens = malloc(batch_size * sizeof(token_t));
+  batch->counts = malloc(batch_size * sizeof(size_t));
+  batch->slots = calloc(capacity, sizeof(uint32_t));
+  batch->slot_mask = capacity - 1;
+  batch->num_distinct = 0;
+  batch->num_words = 0;
+  batch->batch_size = batch_size;
+}
+
+static void word_batch_destroy(word_batch_t *batch) {
+  free(batch->slots);
+  free(batch->counts);
+  free(batch->tokens);
+}
+
+static void word_batch_flush(word_batch_t *batch, word_table_t *table,
+                             pthread_mutex_t *lock) {
+  if (batch->num_distinct == 0) {
+    return;
+  }
+
+  uint64_t locked_at = lock_count(lock);
+  for (size_t i = 0; i < batch->num_distinct; i++) {
+    const token_t *t = &batch->tokens[i];
+    word_table_add_count(table, t->word, t->len, t->hash, batch->counts[i]);
+  }
+  unlock_count(lock, locked_at);
+
+  memset(batch->slots, 0, (batch->slot_mask + 1) * sizeof(uint32_t));
+  batch->num_distinct = 0;
+  batch->num_words = 0;
+}
+
+// Counts tokens into the batch, flushing it into table whenever it is full.
+static void add_token_counts_batched(word_batch_t *batch, word_table_t *table,
+                                     pthread_mutex_t *lock,
+                                     const token_t *tokens,
+                                     size_t num_tokens) {
+  for (size_t i = 0; i < num_tokens; i++) {
+    const token_t *t = &tokens[i];
+    size_t slot = t->hash & batch->slot_mask;
+
+    for (;; slot = (slot + 1) & batch->slot_mask) {
+      uint32_t index = batch->slots[slot];
+      if (index == 0) {
+        batch->tokens[batch->num_distinct] = *t;
+        batch->counts[batch->num_distinct] = 1;
+        batch->slots[slot] = (uint32_t)++batch->num_distinct;
+        break;
+      }
+      const token_t *b = &batch->tokens[index - 1];
+      if (b->hash == t->hash && b->len == t->len &&
+          memcmp(b->word, t->word, t->len) == 0) {
+        batch->counts[index - 1]++;
+        break;
+      }
+    }
+
+    if (++batch->num_words == batch->batch_size) {
+      word_batch_flush(batch, table, lock);
+    }
+  }
+}
+
+// Copies the lock-free map into a count_map_t once every worker has finished,
+// and destroys it. Its keys are distinct, so the stored hashes are reused.
+static count_map_t concurrent_map_finish(concurrent_map_t *cmap) {
+  count_map_t map = NULL;
+  arena_t *arena = new_map_arena();
+  current_arena = arena;
+
+  for (size_t b = 0; b <= cmap->mask; b++) {
+    cmap_node_t *node = atomic_load_explicit(&cmap->buckets[b],
+                                             memory_order_acquire);
+    for (; node; node = node->next) {
+      word_count_entry_t *w = create_entry(
+          node->word, atomic_load_explicit(&node->count, memory_order_relaxed));
+      HASH_ADD_KEYPTR_BYHASHVALUE(hh, map, w->word, node->len, node->hash, w);
+    }
+  }
+
+  current_arena = NULL;
+  drop_unused_arena(arena, map == NULL);
+  concurrent_map_destroy(cmap);
+  return map;
+}
+
+void sharded_map_init(sharded_map_t *shards) {
+  for (size_t i = 0; i < SHARD_COUNT; i++) {
+    word_table_init(&shards->shards[i].table);
+    shards->shards[i].arena = new_table_arena();
+    pthread_mutex_init(&shards->shards[i].lock, NULL);
+  }
+}
+
+// Moves every entry of every shard into a single map and destroys the shards.
+// Shards hold disjoint keys, so no lookups are needed.
+count_map_t sharded_map_flatten(sharded_map_t *shards) {
+  count_map_t map = NULL;
+  arena_t *arena = new_map_arena();
+  current_arena = arena;
+
+  for (size_t i = 0; i < SHARD_COUNT; i++) {
+    if (shards->shards[i].arena) {
+      arena_adopt(arena, shards->shards[i].arena);
+    }
+
+    word_table_drain(&shards->shards[i].table, &map);
+    pthread_mutex_destroy(&shards->shards[i].lock);
+  }
+
+  current_arena = NULL;
+  drop_unused_arena(arena, map == NULL);
+  return map;
+}
+
+// Adds every entry of src into *dst and consumes src. Entries that are new to
+// *dst are moved over rather than copied, and the stored hash is reused so no
+// key is hashed twice.
+void merge_count_maps(count_map_t *dst, count_map_t src) {
+  // Walk the smaller of the two maps.
+  if (HASH_COUNT(*dst) < HASH_COUNT(src)) {
+    count_map_t swap = *dst;
+    *dst = src;
+    src = swap;
+  }
+
+  // Everything src allocated becomes part of the destination's arena.
+  arena_t *arena = map_arena(*dst);
+  arena_t *src_arena = map_arena(src);
+  if (arena && src_arena) {
+    arena_adopt(arena, src_arena);
+  }
+  current_arena = arena;
+
+  word_count_entry_t *current, *tmp;
+  HASH_ITER(hh, src, current, tmp) {
+    unsigned len = current->hh.keylen;
+    unsigned hashv = current->hh.hashv;
     word_count_entry_t *w = NULL;
-    HASH_FIND_STR(*map, words[i], w);
 
+    HASH_DEL(src, current);
+    HASH_FIND_BYHASHVALUE(hh, *dst, current->word, len, hashv, w);
     if (w) {
-      w->count++;
+      w->count += current->count;
+      free_entry(current);
     } else {
-      w = create_entry(words[i], 1);
-      HASH_ADD_STR(*map, word, w);
+      HASH_ADD_KEYPTR_BYHASHVALUE(hh, *dst, current->word, len, hashv,
+                                  current);
     }
+  }
 
-    if (lock)
-      pthread_mutex_unlock(lock); // unlock each pass
+  current_arena = NULL;
+}
+
+typedef struct {
+  word_table_t *dst;
+  word_table_t *src;
+  int cpu; // the CPU the destination was built on if pinned, or -1
+} merge_args_t;
+
+static void *merge_thread_func(void *param) {
+  merge_args_t *args = (merge_args_t *)param;
+  if (args->cpu >= 0) {
+    numa_pin_thread(args->cpu);
   }
+  word_table_merge(args->dst, args->src);
+  return NULL;
+}
+
+// Reduces tables[0..count) into tables[0] in log2(count) rounds. In each
+// round, table i absorbs table i + stride, and all pairs of a round merge in
+// parallel. Table i was built on node[i] (-1 if unknown) and, if cpu is not
+// NULL, its merges run pinned to cpu[i]. With workers placed on nodes in
+// contiguous blocks, only the last rounds cross nodes.
+static void merge_tree(word_table_t *tables, size_t count, const int *cpu,
+                       const int *node) {
+  pthread_t *threads = malloc((count / 2 + 1) * sizeof(pthread_t));
+  merge_args_t *args = malloc((count / 2 + 1) * sizeof(merge_args_t));
+
+  for (size_t stride = 1; stride < count; stride *= 2) {
+    size_t pairs = 0;
+    for (size_t i = 0; i + stride < count; i += 2 * stride) {
+      args[pairs].dst = &tables[i];
+      args[pairs].src = &tables[i + stride];
+      args[pairs].cpu = cpu ? cpu[i] : -1;
+      atomic_fetch_add(&stat_merges, 1);
+      if (node[i] >= 0 && node[i + stride] >= 0 &&
+          node[i] != node[i + stride]) {
+        atomic_fetch_add(&stat_cross_node_merges, 1);
+      }
+      pthread_create(&threads[pairs], NULL, merge_thread_func, &args[pairs]);
+      pairs++;
+    }
+    for (size_t p = 0; p < pairs; p++) {
+      pthread_join(threads[p], NULL);
+    }
+  }
+
+  free(args);
+  free(threads);
 }
 
 static void *counter_thread_func(void *);
 
-static count_map_t count_words_parallel(word_t *words, size_t num_words) {
+// Counts either the words array or, if spans is not NULL, the words found in
+// the spans. Scheduler tasks are chunks of words or whole spans respectively.
+static count_map_t count_parallel(word_t *words, size_t num_words,
+                                  const text_span_t *spans, size_t num_spans,
+                                  const count_options_t *opts) {
   // --------- Task 2 --------- \\
   // Implement this function
   // Hints:
@@ -62,129 +636,429 @@ static count_map_t count_words_parallel(word_t *words, size_t num_words) {
   // - Initialize and pass the mutex to protect the critical sections (Task 4)
 
   count_map_t map = NULL;
+  word_table_t table;
   pthread_mutex_t count_mutex;
+  sharded_map_t *shards = NULL;
+  concurrent_map_t *cmap = NULL;
+  word_table_t *local_tables = NULL;
+  arena_t *map_arena_shared = NULL;
+  task_scheduler_t sched;
 
-  pthread_t threads[THREAD_COUNT];
-  count_thread_args_t *threads_args[THREAD_COUNT];
+  size_t thread_count =
+      opts->num_threads ? opts->num_threads : default_thread_count();
+  pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+  count_thread_args_t **threads_args =
+      malloc(thread_count * sizeof(count_thread_args_t *));
 
-  size_t chunk_size = num_words / THREAD_COUNT;
+  // Many small chunks rather than one slice per thread, so that a thread that
+  // finishes early can steal work from the others.
+  size_t chunk_size = opts->chunk_size ? opts->chunk_size : DEFAULT_CHUNK_SIZE;
+  size_t num_chunks = (num_words + chunk_size - 1) / chunk_size;
+
+  // With NUMA placement, worker i runs on cpu[i] of node[i]. Otherwise
+  // node[] is filled in after the join with wherever the workers ended up.
+  pthread_once(&topology_once, load_topology);
+  int *cpu = NULL;
+  int *node = malloc(thread_count * sizeof(int));
+  _Atomic int *seen_node = malloc(thread_count * sizeof(_Atomic int));
+  for (size_t i = 0; i < thread_count; i++) {
+    atomic_init(&seen_node[i], -1);
+  }
+  if (opts->numa && topology.num_nodes > 0) {
+    cpu = malloc(thread_count * sizeof(int));
+    numa_place_workers(&topology, thread_count, cpu, node);
+  }
+  // A sysfs read per node on either side of the count, so only with -N.
+  uint64_t remote_pages = opts->numa ? numa_remote_pages(&topology) : 0;
 
   // TODO: Perform initialization
   pthread_mutex_init(&count_mutex, NULL);
+  scheduler_init(&sched, thread_count, spans ? num_spans : num_chunks);
+  if (cpu) {
+    scheduler_set_nodes(&sched, node);
+  }
+  if (opts->mode == COUNT_MODE_SHARDED) {
+    shards = malloc(sizeof(sharded_map_t));
+    sharded_map_init(shards);
+  } else if (opts->mode == COUNT_MODE_LOCKFREE) {
+    // Distinct words are bounded by the word count, or by a fraction of the
+    // text size for files.
+    size_t expected = num_words;
+    for (size_t i = 0; spans && i < num_spans; i++) {
+      expected += (spans[i].end - spans[i].begin) / 8;
+    }
+    cmap = malloc(sizeof(concurrent_map_t));
+    concurrent_map_init(cmap, expected, thread_count);
+  } else if (opts->mode == COUNT_MODE_LOCAL) {
+    local_tables = malloc(thread_count * sizeof(word_table_t));
+    for (size_t i = 0; i < thread_count; i++) {
+      word_table_init(&local_tables[i]);
+    }
+  } else {
+    word_table_init(&table);
+    map_arena_shared = new_table_arena();
+  }
 
-  // Launch threads
-  for (size_t i = 0; i < THREAD_COUNT; i++) {
-    word_t *thread_arg_words = words + i * chunk_size;
-    size_t thread_arg_num_words =
-        chunk_size + (i == THREAD_COUNT - 1 ? num_words % THREAD_COUNT : 0);
+  profile_worker_t *prof = profile_workers(thread_count);
+  profile_phase_begin(PHASE_COUNT);
 
+  // Launch threads
+  for (size_t i = 0; i < thread_count; i++) {
     // TODO: Prepare the arguments and launch the threads
-    threads_args[i] =
-        pack_args(&map, thread_arg_words, thread_arg_num_words, &count_mutex);
+    if (local_tables) {
+      // Each thread owns its table, so no lock is needed.
+      threads_args[i] = pack_args(&local_tables[i], words, num_words, NULL);
+      threads_args[i]->arena = new_table_arena();
+    } else {
+      threads_args[i] = pack_args(&table, words, num_words, &count_mutex);
+      threads_args[i]->arena = map_arena_shared;
+    }
+    threads_args[i]->shards = shards;
+    threads_args[i]->cmap = cmap;
+    if (opts->mode == COUNT_MODE_BATCHED) {
+      threads_args[i]->batch_size =
+          opts->batch_size ? opts->batch_size : DEFAULT_BATCH_SIZE;
+    }
+    threads_args[i]->spans = spans;
+    threads_args[i]->sched = &sched;
+    threads_args[i]->worker = i;
+    threads_args[i]->prof = prof ? &prof[i] : NULL;
+    threads_args[i]->chunk_size = chunk_size;
+    threads_args[i]->cpu = cpu ? cpu[i] : -1;
+    threads_args[i]->worker_node = cpu ? node : NULL;
+    threads_args[i]->seen_node = seen_node;
     pthread_create(&threads[i], NULL, counter_thread_func, threads_args[i]);
   }
 
   // TODO: Wait for threads to finish
-  for (size_t i = 0; i < THREAD_COUNT; i++) {
+  for (size_t i = 0; i < thread_count; i++) {
     pthread_join(threads[i], NULL);
   }
+  profile_phase_end(PHASE_COUNT);
+  if (!cpu) {
+    for (size_t i = 0; i < thread_count; i++) {
+      node[i] = atomic_load(&seen_node[i]);
+    }
+  }
 
   // TODO: Cleanup
-  for (size_t i = 0; i < THREAD_COUNT; i++) {
+  for (size_t i = 0; i < thread_count; i++) {
+    if (local_tables) {
+      drop_unused_arena(threads_args[i]->arena,
+                        word_table_empty(&local_tables[i]));
+    }
     free(threads_args[i]);
   }
+  free(threads_args);
+  free(threads);
+  scheduler_destroy(&sched);
   pthread_mutex_destroy(&count_mutex);
 
+  profile_phase_begin(PHASE_MERGE);
+  if (shards) {
+    map = sharded_map_flatten(shards);
+    free(shards);
+  } else if (cmap) {
+    map = concurrent_map_finish(cmap);
+    free(cmap);
+  } else if (local_tables) {
+    merge_tree(local_tables, thread_count, cpu, node);
+    map = word_table_finish(&local_tables[0]);
+    free(local_tables);
+  } else {
+    drop_unused_arena(map_arena_shared, word_table_empty(&table));
+    map = word_table_finish(&table);
+  }
+  profile_phase_end(PHASE_MERGE);
+
+  if (opts->numa) {
+    atomic_fetch_add(&stat_remote_pages,
+                     numa_remote_pages(&topology) - remote_pages);
+  }
+  free(cpu);
+  free(node);
+  free(seen_node);
   return map;
 }
 
-// Takes in an array of words of size num_words and
-// returns a hash table where the key is the word
-// and the value is the number of occurrences
-static word_count_entry_t *count_words_seq(word_t *words, size_t num_words) {
-  word_count_entry_t *map = NULL;
-
-  // Pass all the words as a single chunk
-  add_word_counts_in_chunk(&map, words, num_words, NULL);
+count_map_t count_words_parallel(word_t *words, size_t num_words,
+                                 const count_options_t *opts) {
+  return count_parallel(words, num_words, NULL, 0, opts);
+}
 
+count_map_t count_files_parallel(const mapped_file_t *files, size_t num_files,
+                                 const count_options_t *opts) {
+  text_span_t *spans;
+  size_t num_spans = split_spans(files, num_files, TOKENIZE_SPAN_SIZE, &spans);
+  count_map_t map = count_parallel(NULL, 0, spans, num_spans, opts);
+  free(spans);
   return map;
 }
 
-int sort_func(word_count_entry_t *a, word_count_entry_t *b);
-
-void print_counts(count_map_t);
-void delete_table(count_map_t);
-
-int main(void) {
-  word_t words_in[13] = {"the",  "quick", "brown", "fox", "jumps",
-                         "over", "the",   "lazy",  "dog", "the",
-                         "the",  "fox",   "brown"};
-  const size_t words_in_len = 13;
-  count_map_t word_map = NULL;
-
-  // Task 2: Replace this function call with the parallelized version.
-  // word_map = count_words_seq(words_in, words_in_len);
-  word_map = count_words_parallel(words_in, words_in_len);
-
-  // Print table
-  if (word_map) {
-    // --------- Task 1 --------- \\
-    // Sort the table by the sort function in uthash using `sort_func`.
-    // TODO
-    HASH_SORT(word_map, sort_func);
-
-    print_counts(word_map);
-  }
+// Takes in an array of words of size num_words and
+// returns a hash table where the key is the word
+// and the value is the number of occurrences
+count_map_t count_words_seq(word_t *words, size_t num_words) {
+  word_table_t table;
+  arena_t *arena = new_table_arena();
+  word_table_init(&table);
 
-  // Cleanup
-  if (word_map) {
-    delete_table(word_map);
-  }
+  // Pass all the words as a single chunk
+  current_arena = arena;
+  add_word_counts_in_chunk(&table, words, num_words, NULL);
+  current_arena = NULL;
 
-  return 0;
+  drop_unused_arena(arena, word_table_empty(&table));
+  return word_table_finish(&table);
 }
 
 word_count_entry_t *create_entry(word_t word, size_t count) {
-  word_count_entry_t *ptr = malloc(sizeof(word_count_entry_t));
+  word_count_entry_t *ptr = word_count_alloc(sizeof(word_count_entry_t));
   ptr->word = word;
   ptr->count = count;
   return ptr;
 }
 
+// Words are not NUL-terminated, so compare the common prefix and then the
+// lengths, which orders them the same way strcmp would.
 int sort_func(word_count_entry_t *a, word_count_entry_t *b) {
-  return strcmp(a->word, b->word);
+  unsigned len_a = a->hh.keylen, len_b = b->hh.keylen;
+  int cmp = memcmp(a->word, b->word, len_a < len_b ? len_a : len_b);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return len_a < len_b ? -1 : len_a > len_b;
 }
 
 void print_counts(count_map_t word_map) {
   printf("%-32s%-10s\n", "Word", "Count");
   word_count_entry_t *current, *tmp;
   HASH_ITER(hh, word_map, current, tmp) {
-    printf("%-32s%-10zu\n", current->word, current->count);
+    printf("%-32.*s%-10zu\n", (int)current->hh.keylen, current->word,
+           current->count);
   }
 }
 
+void free_entry(word_count_entry_t *entry) {
+  word_count_free(entry, sizeof(word_count_entry_t));
+}
+
 void delete_table(count_map_t word_map) {
+  // Entries and buckets all live in one arena, so drop it in one go.
+  if (use_arena) {
+    if (word_map) {
+      arena_release(arena_of(word_map));
+    }
+    return;
+  }
+
   word_count_entry_t *current, *tmp;
   HASH_ITER(hh, word_map, current, tmp) {
     HASH_DEL(word_map, current);
-    free(current);
+    free_entry(current);
   }
 }
 
-count_thread_args_t *pack_args(count_map_t *map, word_t *words,
+count_thread_args_t *pack_args(word_table_t *table, word_t *words,
                                size_t num_words, pthread_mutex_t *lock) {
   count_thread_args_t *args = malloc(sizeof(count_thread_args_t));
-  args->map = map;
+  args->table = table;
   args->words = words;
   args->num_words = num_words;
   args->lock = lock;
+  args->shards = NULL;
+  args->cmap = NULL;
+  args->batch = NULL;
+  args->batch_size = 0;
+  args->prof = NULL;
+  args->arena = NULL;
+  args->spans = NULL;
+  args->sched = NULL;
+  args->worker = 0;
+  args->chunk_size = num_words;
+  args->cpu = -1;
+  args->worker_node = NULL;
+  args->seen_node = NULL;
   return args;
 }
 
+// Counts tokens whose hashes are already filled in into the thread's table,
+// using whichever mode args was set up for.
+static void count_interned(count_thread_args_t *args, const token_t *tokens,
+                           size_t num_tokens) {
+  if (args->shards) {
+    add_token_counts_sharded(args->shards, tokens, num_tokens);
+  } else if (args->cmap) {
+    add_token_counts_lockfree(args->cmap, args->worker, tokens, num_tokens);
+  } else if (args->batch) {
+    add_token_counts_batched(args->batch, args->table, args->lock, tokens,
+                             num_tokens);
+  } else {
+    add_token_counts(args->table, tokens, num_tokens, args->lock);
+  }
+}
+
+// Like count_interned, but adds the time taken to the worker's profile.
+static void count_interned_profiled(count_thread_args_t *args,
+                                    const token_t *tokens, size_t num_tokens) {
+  if (!args->prof) {
+    count_interned(args, tokens, num_tokens);
+    return;
+  }
+
+  uint64_t start = profile_now_ns();
+  count_interned(args, tokens, num_tokens);
+  args->prof->count_ns += profile_now_ns() - start;
+  args->prof->words += num_tokens;
+}
+
+// Tokenizer callback that interns a batch of words and counts them.
+static void count_tokens(void *param, token_t *tokens, size_t num_tokens) {
+  count_thread_args_t *args = (count_thread_args_t *)param;
+
+  intern_tokens(tokens, num_tokens);
+  count_interned_profiled(args, tokens, num_tokens);
+}
+
 static void *counter_thread_func(void *param) {
   // Call count_words_in_chunk with the appropriate arguments
   count_thread_args_t *args = (count_thread_args_t *)param;
-  add_word_counts_in_chunk(args->map, args->words, args->num_words, args->lock);
+  profile_worker_t *prof = args->prof;
+  word_batch_t batch;
+  token_t tokens[TOKEN_BATCH_SIZE];
+  size_t chunk;
+  uint64_t started = prof ? profile_now_ns() : 0;
+  uint64_t task_ns = 0;
+
+  // Pin first, so that everything this worker allocates from here on, its
+  // table included, is first touched on its own node.
+  if (args->cpu >= 0) {
+    numa_pin_thread(args->cpu);
+  }
+
+  // Pinned workers copy the word pointers of their own chunks to local
+  // memory. Stolen chunks are read where they are.
+  word_t *local_words = NULL;
+  size_t local_begin = 0, local_end = 0;
+  if (args->cpu >= 0 && !args->spans) {
+    size_t first, last;
+    scheduler_home_range(args->sched, args->worker, &first, &last);
+    local_begin = first * args->chunk_size;
+    local_end = last * args->chunk_size < args->num_words
+                    ? last * args->chunk_size
+                    : args->num_words;
+    if (local_end > local_begin) {
+      local_words = malloc((local_end - local_begin) * sizeof(word_t));
+      memcpy(local_words, args->words + local_begin,
+             (local_end - local_begin) * sizeof(word_t));
+    }
+  }
+
+  // Sharded mode switches arenas per word instead.
+  current_arena = args->arena;
+  if (args->batch_size) {
+    word_batch_init(&batch, args->batch_size);
+    args->batch = &batch;
+  }
 
+  size_t tasks = 0, remote_tasks = 0, node_switches = 0;
+  int last_node = -1;
+  while (scheduler_next(args->sched, args->worker, &chunk)) {
+    uint64_t task_start = prof ? profile_now_ns() : 0;
+
+    int node = numa_current_node(&topology);
+    if (last_node >= 0 && node != last_node) {
+      node_switches++;
+    }
+    last_node = node;
+    atomic_store_explicit(&args->seen_node[args->worker], node,
+                          memory_order_relaxed);
+    size_t home = scheduler_home_worker(args->sched, chunk);
+    int home_node = args->worker_node ? args->worker_node[home]
+                                      : atomic_load_explicit(
+                                            &args->seen_node[home],
+                                            memory_order_relaxed);
+    remote_tasks += home_node >= 0 && node >= 0 && home_node != node;
+    tasks++;
+
+    if (args->spans) {
+      tokenize_span(&args->spans[chunk], count_tokens, args);
+    } else {
+      size_t begin = chunk * args->chunk_size;
+      size_t len = args->num_words - begin < args->chunk_size
+                       ? args->num_words - begin
+                       : args->chunk_size;
+      const word_t *src = local_words && begin >= local_begin &&
+                                  begin < local_end
+                              ? local_words + (begin - local_begin)
+                              : args->words + begin;
+
+      for (size_t i = 0; i < len; i += TOKEN_BATCH_SIZE) {
+        size_t n = len - i < TOKEN_BATCH_SIZE ? len - i : TOKEN_BATCH_SIZE;
+        intern_words(src + i, n, tokens);
+        count_interned_profiled(args, tokens, n);
+      }
+    }
+
+    if (prof) {
+      task_ns += profile_now_ns() - task_start;
+      prof->tasks++;
+    }
+  }
+  free(local_words);
+  atomic_fetch_add(&stat_numa_tasks, tasks);
+  atomic_fetch_add(&stat_remote_tasks, remote_tasks);
+  atomic_fetch_add(&stat_node_switches, node_switches);
+
+  if (args->batch) {
+    word_batch_flush(args->batch, args->table, args->lock);
+    word_batch_destroy(args->batch);
+    args->batch = NULL;
+  }
+  flush_lock_stats(prof);
+  if (prof) {
+    // Whatever a task did besides counting was scanning and hashing.
+    prof->tokenize_ns = task_ns - prof->count_ns;
+    prof->wall_ns = profile_now_ns() - started;
+  }
   return NULL;
 }
+
+// Worker count from the LAB8_THREADS environment variable, or the number of
+// online CPUs if it is unset.
+size_t default_thread_count(void) {
+  const char *env = getenv("LAB8_THREADS");
+  if (env) {
+    long n = strtol(env, NULL, 10);
+    if (n > 0) {
+      return (size_t)n;
+    }
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t)cpus : 1;
+}
+
+static const char *const count_mode_names[] = {
+    [COUNT_MODE_MUTEX] = "mutex",
+    [COUNT_MODE_SHARDED] = "sharded",
+    [COUNT_MODE_LOCAL] = "local",
+    [COUNT_MODE_LOCKFREE] = "lockfree",
+    [COUNT_MODE_BATCHED] = "batched",
+};
+
+const char *count_mode_name(count_mode_t mode) {
+  return count_mode_names[mode];
+}
+
+// Returns 0 and sets *mode if name is a known mode, -1 otherwise.
+int parse_count_mode(const char *name, count_mode_t *mode) {
+  for (size_t i = 0;
+       i < sizeof(count_mode_names) / sizeof(count_mode_names[0]); i++) {
+    if (strcmp(name, count_mode_names[i]) == 0) {
+      *mode = (count_mode_t)i;
+      return 0;
+    }
+  }
+  return -1;
+}
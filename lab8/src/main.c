@@ -0,0 +1,308 @@
+// Lab 8 - Driver for the uthash word counter
+#include "lab8.h"
+#include "output.h"
+#include "profile.h"
+#include "sort.h"
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-m mutex|sharded|local|lockfree|batched] "
+          "[-t threads] [-c chunk_size] [-b batch_size] [-a] [-s] [-N] "
+          "[-k|--top K] [-f|--format text|tsv|binary|printf] "
+          "[--profile[=FILE]] [file...]\n"
+          "       %s --stream[=MS] [--follow] [-t threads] [-k|--top K] "
+          "[-f format] [file|-]\n",
+          prog, prog);
+}
+
+static void on_stop_signal(int sig) {
+  (void)sig;
+  stream_stop();
+}
+
+// Counts fd continuously, printing the top words every interval, until it
+// ends or SIGINT/SIGTERM arrives.
+static int run_stream(const char *path, const stream_options_t *opts) {
+  int fd = STDIN_FILENO;
+  if (path && strcmp(path, "-") != 0) {
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      return 1;
+    }
+  }
+
+  // No SA_RESTART, so a blocked read() returns and sees the stop.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_stop_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  int ret = stream_count(fd, opts);
+  if (ret == -1) {
+    perror(path ? path : "stdin");
+  }
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+  return ret == -1 ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  count_options_t opts = {
+      .mode = COUNT_MODE_MUTEX,
+      .num_threads = 0,
+      .chunk_size = 0,
+      .batch_size = 0,
+      .numa = 0,
+  };
+  int lock_stats = 0;
+  int profile = 0;
+  const char *profile_path = NULL; // stderr if NULL
+  size_t top_k = 0;
+  output_format_t format = OUTPUT_TEXT;
+  int arena = 0;
+  int stream = 0;
+  int follow = 0;
+  unsigned interval_ms = 0;
+  int opt;
+
+  static const struct option long_opts[] = {
+      {"top", required_argument, NULL, 'k'},
+      {"format", required_argument, NULL, 'f'},
+      {"profile", optional_argument, NULL, 'P'},
+      {"stream", optional_argument, NULL, 'S'},
+      {"follow", no_argument, NULL, 'F'},
+      {"numa", no_argument, NULL, 'N'},
+      {NULL, 0, NULL, 0},
+  };
+
+  while ((opt = getopt_long(argc, argv, "m:t:c:b:ask:f:N", long_opts,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'm':
+      if (parse_count_mode(optarg, &opts.mode) == -1) {
+        fprintf(stderr, "Unknown mode: %s\n", optarg);
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 't':
+      opts.num_threads = strtoull(optarg, NULL, 10);
+      if (opts.num_threads == 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'c':
+      opts.chunk_size = strtoull(optarg, NULL, 10);
+      if (opts.chunk_size == 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'b':
+      opts.batch_size = strtoull(optarg, NULL, 10);
+      if (opts.batch_size == 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'a':
+      arena = 1;
+      set_arena_enabled(1);
+      break;
+    case 'N':
+      opts.numa = 1;
+      break;
+    case 's':
+      lock_stats = 1;
+      set_lock_stats_enabled(1);
+      break;
+    case 'k': {
+      // strtoull would wrap "-3" to a huge K, which prints everything.
+      char *end;
+      errno = 0;
+      long long k = strtoll(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || errno == ERANGE || k < 1) {
+        usage(argv[0]);
+        return 1;
+      }
+      top_k = (size_t)k;
+      break;
+    }
+    case 'f':
+      if (parse_output_format(optarg, &format) == -1) {
+        fprintf(stderr, "Unknown format: %s\n", optarg);
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'P':
+      profile = 1;
+      profile_path = optarg;
+      break;
+    case 'S':
+      stream = 1;
+      if (optarg) {
+        interval_ms = (unsigned)strtoul(optarg, NULL, 10);
+        if (interval_ms == 0) {
+          usage(argv[0]);
+          return 1;
+        }
+      }
+      break;
+    case 'F':
+      follow = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (stream || follow) {
+    // Stream entries are freed one by one, and there is one input at most.
+    if (!stream || argc - optind > 1 || (follow && argc - optind == 0)) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (arena || lock_stats || profile) {
+      fprintf(stderr, "-a, -s and --profile do not apply to --stream\n");
+    }
+    set_arena_enabled(0);
+    stream_options_t stream_opts = {
+        .num_threads = opts.num_threads,
+        .top_k = top_k,
+        .interval_ms = interval_ms,
+        .follow = follow,
+        .format = format,
+    };
+    return run_stream(optind < argc ? argv[optind] : NULL, &stream_opts);
+  }
+
+  // The hardware counters only follow threads started after this.
+  if (profile) {
+    profile_enable();
+    set_lock_stats_enabled(1);
+  }
+
+  word_t words_in[13] = {"the",  "quick", "brown", "fox", "jumps",
+                         "over", "the",   "lazy",  "dog", "the",
+                         "the",  "fox",   "brown"};
+  const size_t words_in_len = 13;
+  count_map_t word_map = NULL;
+
+  // Files named on the command line replace the built-in words. They stay
+  // mapped until the table is deleted, since the entries point into them.
+  size_t num_files = argc - optind;
+  mapped_file_t *files = calloc(num_files, sizeof(mapped_file_t));
+  profile_phase_begin(PHASE_MAP);
+  for (size_t i = 0; i < num_files; i++) {
+    if (map_file(argv[optind + i], &files[i]) == -1) {
+      fprintf(stderr, "%s: %s\n", argv[optind + i], strerror(errno));
+      return 1;
+    }
+  }
+  profile_phase_end(PHASE_MAP);
+
+  // Task 2: Replace this function call with the parallelized version.
+  // word_map = count_words_seq(words_in, words_in_len);
+  if (num_files > 0) {
+    word_map = count_files_parallel(files, num_files, &opts);
+  } else {
+    word_map = count_words_parallel(words_in, words_in_len, &opts);
+  }
+
+  if (lock_stats) {
+    lock_stats_t stats;
+    get_lock_stats(&stats);
+    fprintf(stderr,
+            "locks: %zu acquisitions, %.3f ms waited, %.3f ms held, "
+            "%.1f ns held each\n",
+            stats.acquisitions, stats.wait_ns / 1e6, stats.hold_ns / 1e6,
+            stats.acquisitions ? (double)stats.hold_ns / stats.acquisitions
+                               : 0.0);
+  }
+
+  if (opts.numa) {
+    numa_stats_t numa;
+    get_numa_stats(&numa);
+    fprintf(stderr,
+            "numa: %zu nodes, %zu/%zu tasks remote, %zu node switches, "
+            "%zu/%zu merges cross-node, %llu remote pages\n",
+            numa.nodes, numa.remote_tasks, numa.tasks, numa.node_switches,
+            numa.cross_node_merges, numa.merges,
+            (unsigned long long)numa.remote_pages);
+  }
+
+  size_t num_threads =
+      opts.num_threads ? opts.num_threads : default_thread_count();
+
+  // Print table
+  if (word_map) {
+    // --------- Task 1 --------- \\
+    // Sort the table by the sort function in uthash using `sort_func`.
+    // HASH_SORT(word_map, sort_func);
+    // Sorting is done on an array of entry pointers instead, by the same
+    // threads that counted, and --top K only ever orders K entries.
+    size_t count;
+    profile_phase_begin(PHASE_SORT);
+    word_count_entry_t **entries =
+        top_k ? top_k_entries(word_map, top_k, num_threads, &count)
+              : sort_entries_parallel(word_map, num_threads, &count);
+    profile_phase_end(PHASE_SORT);
+
+    profile_phase_begin(PHASE_PRINT);
+    char *buf = malloc(OUTPUT_BUFFER_SIZE);
+    if (!buf) {
+      perror("malloc");
+      return 1;
+    }
+    out_buf_t out;
+    out_buf_init(&out, STDOUT_FILENO, buf, OUTPUT_BUFFER_SIZE);
+    if (write_entries(&out, entries, count, format) == -1) {
+      perror("write");
+      return 1;
+    }
+    free(buf);
+    profile_phase_end(PHASE_PRINT);
+    free(entries);
+  }
+
+  // Cleanup
+  profile_phase_begin(PHASE_CLEANUP);
+  if (word_map) {
+    delete_table(word_map);
+  }
+  for (size_t i = 0; i < num_files; i++) {
+    unmap_file(&files[i]);
+  }
+  free(files);
+  profile_phase_end(PHASE_CLEANUP);
+
+  if (profile) {
+    FILE *out = profile_path ? fopen(profile_path, "w") : stderr;
+    if (!out) {
+      fprintf(stderr, "%s: %s\n", profile_path, strerror(errno));
+      return 1;
+    }
+    profile_report(out, count_mode_name(opts.mode), num_threads);
+    if (out != stderr) {
+      fclose(out);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,161 @@
+// Lab 8 - NUMA topology from sysfs, worker placement and pinning
+#define _GNU_SOURCE
+#include "numa.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_DIR "/sys/devices/system/node"
+
+// Parses a cpulist such as "0-3,8-11" and calls fn for every CPU in it.
+static void parse_cpulist(const char *list, void (*fn)(void *, int),
+                          void *ctx) {
+  const char *p = list;
+  while (*p && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p) {
+      return;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      fn(ctx, (int)cpu);
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+}
+
+typedef struct {
+  numa_topology_t *topo;
+  const cpu_set_t *allowed;
+  int node;
+} add_cpu_ctx_t;
+
+static void add_cpu(void *param, int cpu) {
+  add_cpu_ctx_t *ctx = param;
+  numa_topology_t *topo = ctx->topo;
+  if (cpu < 0 || (size_t)cpu >= topo->cpu_limit ||
+      !CPU_ISSET(cpu, ctx->allowed) || topo->node_of_cpu[cpu] != -1) {
+    return;
+  }
+  topo->node_of_cpu[cpu] = ctx->node;
+  topo->cpus[topo->node_first[ctx->node + 1]++] = cpu;
+}
+
+int numa_topology_load(numa_topology_t *topo) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+    return -1;
+  }
+
+  memset(topo, 0, sizeof(*topo));
+  topo->cpu_limit = CPU_SETSIZE;
+  topo->cpus = malloc(CPU_SETSIZE * sizeof(int));
+  topo->node_of_cpu = malloc(CPU_SETSIZE * sizeof(int));
+  for (size_t i = 0; i < CPU_SETSIZE; i++) {
+    topo->node_of_cpu[i] = -1;
+  }
+
+  char path[64], list[4096];
+  for (int id = 0; id < NUMA_MAX_NODES; id++) {
+    snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", id);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      continue;
+    }
+    if (fgets(list, sizeof(list), f)) {
+      size_t n = topo->num_nodes;
+      topo->node_first[n + 1] = topo->node_first[n];
+      add_cpu_ctx_t ctx = {topo, &allowed, (int)n};
+      parse_cpulist(list, add_cpu, &ctx);
+      // Nodes with memory but none of our CPUs do not get workers.
+      if (topo->node_first[n + 1] > topo->node_first[n]) {
+        topo->node_id[n] = id;
+        topo->num_nodes++;
+      }
+    }
+    fclose(f);
+  }
+
+  if (topo->num_nodes == 0) {
+    topo->node_id[0] = 0;
+    topo->node_first[1] = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        topo->node_of_cpu[cpu] = 0;
+        topo->cpus[topo->node_first[1]++] = cpu;
+      }
+    }
+    topo->num_nodes = 1;
+  }
+  return 0;
+}
+
+void numa_topology_free(numa_topology_t *topo) {
+  free(topo->cpus);
+  free(topo->node_of_cpu);
+  topo->cpus = NULL;
+  topo->node_of_cpu = NULL;
+  topo->num_nodes = 0;
+}
+
+void numa_place_workers(const numa_topology_t *topo, size_t num_workers,
+                        int *cpu, int *node) {
+  for (size_t i = 0; i < num_workers; i++) {
+    size_t n = i * topo->num_nodes / num_workers;
+    // Index of this worker within its node's block.
+    size_t first_worker = (n * num_workers + topo->num_nodes - 1) /
+                          topo->num_nodes;
+    size_t node_cpus = topo->node_first[n + 1] - topo->node_first[n];
+    node[i] = (int)n;
+    cpu[i] = topo->cpus[topo->node_first[n] + (i - first_worker) % node_cpus];
+  }
+}
+
+int numa_pin_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+int numa_current_node(const numa_topology_t *topo) {
+  int cpu = sched_getcpu();
+  if (cpu < 0 || (size_t)cpu >= topo->cpu_limit || !topo->node_of_cpu) {
+    return -1;
+  }
+  return topo->node_of_cpu[cpu];
+}
+
+uint64_t numa_remote_pages(const numa_topology_t *topo) {
+  char path[64], line[128];
+  uint64_t total = 0;
+  for (size_t n = 0; n < topo->num_nodes; n++) {
+    snprintf(path, sizeof(path), NODE_DIR "/node%d/numastat",
+             topo->node_id[n]);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      continue;
+    }
+    unsigned long long value;
+    while (fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "other_node %llu", &value) == 1) {
+        total += value;
+      }
+    }
+    fclose(f);
+  }
+  return total;
+}
@@ -0,0 +1,226 @@
+// Lab 8 - Buffered, printf-free output of word count entries
+#include "output.h"
+#include "sort.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WORD_WIDTH 32
+#define COUNT_WIDTH 10
+#define MAX_DIGITS 20
+
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+void out_buf_init(out_buf_t *out, int fd, char *buf, size_t cap) {
+  out->fd = fd;
+  out->buf = buf;
+  out->cap = cap;
+  out->len = 0;
+  out->error = 0;
+  out->bytes_written = 0;
+  out->num_writes = 0;
+}
+
+static void write_all(out_buf_t *out, const char *data, size_t len) {
+  while (len > 0 && !out->error) {
+    ssize_t n = write(out->fd, data, len);
+    out->num_writes++;
+    if (n == -1) {
+      if (errno != EINTR) {
+        out->error = errno;
+      }
+      continue;
+    }
+    data += n;
+    len -= (size_t)n;
+    out->bytes_written += (size_t)n;
+  }
+}
+
+int out_flush(out_buf_t *out) {
+  write_all(out, out->buf, out->len);
+  out->len = 0;
+  if (out->error) {
+    errno = out->error;
+    return -1;
+  }
+  return 0;
+}
+
+void out_bytes(out_buf_t *out, const void *data, size_t len) {
+  if (len > out->cap - out->len) {
+    out_flush(out);
+    if (len > out->cap) {
+      write_all(out, data, len);
+      return;
+    }
+  }
+  memcpy(out->buf + out->len, data, len);
+  out->len += len;
+}
+
+// Returns room for n more bytes in the buffer, flushing it first if needed,
+// or NULL if n does not fit even in an empty buffer.
+static char *out_reserve(out_buf_t *out, size_t n) {
+  if (n > out->cap - out->len) {
+    out_flush(out);
+    if (n > out->cap) {
+      return NULL;
+    }
+  }
+  return out->buf + out->len;
+}
+
+size_t format_uint(char *dst, uint64_t value) {
+  // Fill a scratch buffer from the end, two digits per division.
+  char tmp[MAX_DIGITS];
+  char *p = tmp + MAX_DIGITS;
+  while (value >= 100) {
+    unsigned pair = (unsigned)(value % 100) * 2;
+    value /= 100;
+    p -= 2;
+    p[0] = digit_pairs[pair];
+    p[1] = digit_pairs[pair + 1];
+  }
+  if (value >= 10) {
+    p -= 2;
+    p[0] = digit_pairs[value * 2];
+    p[1] = digit_pairs[value * 2 + 1];
+  } else {
+    *--p = (char)('0' + value);
+  }
+  size_t len = (size_t)(tmp + MAX_DIGITS - p);
+  memcpy(dst, p, len);
+  return len;
+}
+
+// Appends len bytes of s left-justified in a field of width, like "%-*.*s".
+// p must have room for the larger of len and width.
+static char *put_padded(char *p, const char *s, size_t len, size_t width) {
+  memcpy(p, s, len);
+  p += len;
+  if (len < width) {
+    memset(p, ' ', width - len);
+    p += width - len;
+  }
+  return p;
+}
+
+// One "%-32.*s%-10zu\n" line.
+static void put_text(out_buf_t *out, const char *word, size_t len,
+                     size_t count) {
+  char digits[MAX_DIGITS];
+  size_t num_digits = format_uint(digits, count);
+  size_t n = (len > WORD_WIDTH ? len : WORD_WIDTH) + COUNT_WIDTH + 1;
+  n += num_digits > COUNT_WIDTH ? num_digits - COUNT_WIDTH : 0;
+
+  char *start = out_reserve(out, n);
+  if (!start) {
+    // A word longer than the whole buffer: write it in pieces.
+    out_bytes(out, word, len);
+    char line[COUNT_WIDTH + MAX_DIGITS + 1];
+    char *p = put_padded(line, digits, num_digits, COUNT_WIDTH);
+    *p++ = '\n';
+    out_bytes(out, line, (size_t)(p - line));
+    return;
+  }
+  char *p = put_padded(start, word, len, WORD_WIDTH);
+  p = put_padded(p, digits, num_digits, COUNT_WIDTH);
+  *p++ = '\n';
+  out->len += (size_t)(p - start);
+}
+
+static void put_tsv(out_buf_t *out, const char *word, size_t len,
+                    size_t count) {
+  char *p = out_reserve(out, len + MAX_DIGITS + 2);
+  if (!p) {
+    char line[MAX_DIGITS + 2];
+    line[0] = '\t';
+    size_t n = format_uint(line + 1, count) + 1;
+    line[n++] = '\n';
+    out_bytes(out, word, len);
+    out_bytes(out, line, n);
+    return;
+  }
+  char *start = p;
+  memcpy(p, word, len);
+  p += len;
+  *p++ = '\t';
+  p += format_uint(p, count);
+  *p++ = '\n';
+  out->len += (size_t)(p - start);
+}
+
+static void put_binary(out_buf_t *out, const char *word, size_t len,
+                       size_t count) {
+  uint64_t count64 = count;
+  uint32_t len32 = (uint32_t)len;
+  out_bytes(out, &count64, sizeof(count64));
+  out_bytes(out, &len32, sizeof(len32));
+  out_bytes(out, word, len);
+}
+
+int write_entries(out_buf_t *out, word_count_entry_t **entries, size_t count,
+                  output_format_t format) {
+  switch (format) {
+  case OUTPUT_PRINTF:
+    print_entries(entries, count);
+    return fflush(stdout) == EOF ? -1 : 0;
+  case OUTPUT_TEXT: {
+    char header[WORD_WIDTH + COUNT_WIDTH + 1];
+    char *p = put_padded(header, "Word", 4, WORD_WIDTH);
+    p = put_padded(p, "Count", 5, COUNT_WIDTH);
+    *p++ = '\n';
+    out_bytes(out, header, (size_t)(p - header));
+    for (size_t i = 0; i < count; i++) {
+      put_text(out, entries[i]->word, entries[i]->hh.keylen,
+               entries[i]->count);
+    }
+    break;
+  }
+  case OUTPUT_TSV:
+    for (size_t i = 0; i < count; i++) {
+      put_tsv(out, entries[i]->word, entries[i]->hh.keylen, entries[i]->count);
+    }
+    break;
+  case OUTPUT_BINARY: {
+    uint64_t num_records = count;
+    out_bytes(out, OUTPUT_BINARY_MAGIC, sizeof(OUTPUT_BINARY_MAGIC) - 1);
+    out_bytes(out, &num_records, sizeof(num_records));
+    for (size_t i = 0; i < count; i++) {
+      put_binary(out, entries[i]->word, entries[i]->hh.keylen,
+                 entries[i]->count);
+    }
+    break;
+  }
+  }
+  return out_flush(out);
+}
+
+static const char *const output_format_names[] = {
+    [OUTPUT_TEXT] = "text",
+    [OUTPUT_TSV] = "tsv",
+    [OUTPUT_BINARY] = "binary",
+    [OUTPUT_PRINTF] = "printf",
+};
+
+int parse_output_format(const char *name, output_format_t *format) {
+  for (size_t i = 0;
+       i < sizeof(output_format_names) / sizeof(output_format_names[0]); i++) {
+    if (strcmp(name, output_format_names[i]) == 0) {
+      *format = (output_format_t)i;
+      return 0;
+    }
+  }
+  return -1;
+}
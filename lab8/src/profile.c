@@ -0,0 +1,172 @@
+// Lab 8 - Optional per-phase, per-thread and hardware-counter profiling
+#include "profile.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  const char *name;
+  uint64_t config;
+} hw_counter_t;
+
+static const hw_counter_t hw_counters[] = {
+    {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache_misses", PERF_COUNT_HW_CACHE_MISSES},
+    {"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+};
+#define NUM_HW_COUNTERS (sizeof(hw_counters) / sizeof(hw_counters[0]))
+
+static const char *const phase_names[PHASE_COUNT_OF] = {
+    [PHASE_MAP] = "map",     [PHASE_COUNT] = "count",
+    [PHASE_MERGE] = "merge", [PHASE_SORT] = "sort",
+    [PHASE_PRINT] = "print", [PHASE_CLEANUP] = "cleanup",
+};
+
+// Phases are entered and left by the main thread only.
+static int enabled = 0;
+static uint64_t phase_ns[PHASE_COUNT_OF];
+static uint64_t phase_start[PHASE_COUNT_OF];
+static profile_worker_t *workers = NULL;
+static size_t num_workers = 0;
+static int hw_fds[NUM_HW_COUNTERS];
+static int hw_errno = 0; // why the counters are missing, if they are
+
+uint64_t profile_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Opens one user-space counter for this process and every thread it starts
+// from now on. Returns the fd, or -1 with errno set.
+static int open_hw_counter(uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void open_hw_counters(void) {
+  for (size_t i = 0; i < NUM_HW_COUNTERS; i++) {
+    hw_fds[i] = open_hw_counter(hw_counters[i].config);
+    if (hw_fds[i] == -1) {
+      // Report all or nothing, so ratios such as IPC are always meaningful.
+      hw_errno = errno;
+      for (size_t j = 0; j < i; j++) {
+        close(hw_fds[j]);
+        hw_fds[j] = -1;
+      }
+      return;
+    }
+  }
+}
+
+void profile_enable(void) {
+  if (enabled) {
+    return;
+  }
+  enabled = 1;
+  open_hw_counters();
+}
+
+int profile_enabled(void) { return enabled; }
+
+void profile_phase_begin(profile_phase_t phase) {
+  if (enabled) {
+    phase_start[phase] = profile_now_ns();
+  }
+}
+
+void profile_phase_end(profile_phase_t phase) {
+  if (enabled) {
+    phase_ns[phase] += profile_now_ns() - phase_start[phase];
+  }
+}
+
+profile_worker_t *profile_workers(size_t count) {
+  if (!enabled) {
+    return NULL;
+  }
+  free(workers);
+  workers = calloc(count, sizeof(profile_worker_t));
+  num_workers = count;
+  return workers;
+}
+
+static double seconds(uint64_t ns) { return ns / 1e9; }
+
+static void report_hw_counters(FILE *out) {
+  if (hw_errno || !enabled) {
+    fprintf(out, "  \"perf\": {\"available\": false, \"error\": \"%s\"}\n",
+            hw_errno ? strerror(hw_errno) : "profiling off");
+    return;
+  }
+
+  uint64_t values[NUM_HW_COUNTERS];
+  fprintf(out, "  \"perf\": {\"available\": true");
+  for (size_t i = 0; i < NUM_HW_COUNTERS; i++) {
+    if (read(hw_fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+      values[i] = 0;
+    }
+    fprintf(out, ", \"%s\": %llu", hw_counters[i].name,
+            (unsigned long long)values[i]);
+  }
+  // cycles and instructions are the first two counters.
+  fprintf(out, ", \"ipc\": %.3f}\n",
+          values[0] ? (double)values[1] / values[0] : 0.0);
+}
+
+void profile_report(FILE *out, const char *mode, size_t num_threads) {
+  profile_worker_t total;
+  memset(&total, 0, sizeof(total));
+  for (size_t i = 0; i < num_workers; i++) {
+    total.lock_wait_ns += workers[i].lock_wait_ns;
+    total.lock_hold_ns += workers[i].lock_hold_ns;
+    total.lock_acquisitions += workers[i].lock_acquisitions;
+  }
+
+  fprintf(out, "{\n  \"mode\": \"%s\",\n  \"threads\": %zu,\n", mode,
+          num_threads);
+
+  fprintf(out, "  \"phases\": {");
+  uint64_t all = 0;
+  for (int p = 0; p < PHASE_COUNT_OF; p++) {
+    fprintf(out, "%s\"%s\": %.6f", p ? ", " : "", phase_names[p],
+            seconds(phase_ns[p]));
+    all += phase_ns[p];
+  }
+  fprintf(out, ", \"total\": %.6f},\n", seconds(all));
+
+  fprintf(out,
+          "  \"locks\": {\"acquisitions\": %zu, \"wait_s\": %.6f, "
+          "\"hold_s\": %.6f},\n",
+          total.lock_acquisitions, seconds(total.lock_wait_ns),
+          seconds(total.lock_hold_ns));
+
+  fprintf(out, "  \"workers\": [");
+  for (size_t i = 0; i < num_workers; i++) {
+    const profile_worker_t *w = &workers[i];
+    fprintf(out,
+            "%s\n    {\"id\": %zu, \"wall_s\": %.6f, \"tokenize_s\": %.6f, "
+            "\"count_s\": %.6f, \"lock_wait_s\": %.6f, \"lock_hold_s\": %.6f, "
+            "\"lock_acquisitions\": %zu, \"tasks\": %zu, \"words\": %zu}",
+            i ? "," : "", i, seconds(w->wall_ns), seconds(w->tokenize_ns),
+            seconds(w->count_ns), seconds(w->lock_wait_ns),
+            seconds(w->lock_hold_ns), w->lock_acquisitions, w->tasks,
+            w->words);
+  }
+  fprintf(out, "%s],\n", num_workers ? "\n  " : "");
+
+  report_hw_counters(out);
+  fprintf(out, "}\n");
+}
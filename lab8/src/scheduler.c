@@ -0,0 +1,104 @@
+// Lab 8 - Work-stealing scheduler over a fixed set of task indices
+#include "scheduler.h"
+#include <stdlib.h>
+
+#define RANGE(top, bottom) (((uint64_t)(top) << 32) | (uint32_t)(bottom))
+#define RANGE_TOP(r) ((uint32_t)((r) >> 32))
+#define RANGE_BOTTOM(r) ((uint32_t)(r))
+
+void scheduler_init(task_scheduler_t *sched, size_t num_workers,
+                    size_t num_tasks) {
+  sched->deques = aligned_alloc(64, num_workers * sizeof(task_deque_t));
+  sched->num_workers = num_workers;
+  sched->num_tasks = num_tasks;
+  sched->worker_node = NULL;
+
+  for (size_t i = 0; i < num_workers; i++) {
+    size_t top = num_tasks * i / num_workers;
+    size_t bottom = num_tasks * (i + 1) / num_workers;
+    atomic_init(&sched->deques[i].range, RANGE(top, bottom));
+  }
+}
+
+void scheduler_destroy(task_scheduler_t *sched) {
+  free(sched->deques);
+  sched->deques = NULL;
+}
+
+void scheduler_set_nodes(task_scheduler_t *sched, const int *worker_node) {
+  sched->worker_node = worker_node;
+}
+
+size_t scheduler_home_worker(const task_scheduler_t *sched, size_t task) {
+  // The inverse of the split in scheduler_init: the last worker whose top
+  // is at most task.
+  size_t n = sched->num_workers, t = sched->num_tasks;
+  return ((task + 1) * n + t - 1) / t - 1;
+}
+
+void scheduler_home_range(const task_scheduler_t *sched, size_t worker,
+                          size_t *begin, size_t *end) {
+  *begin = sched->num_tasks * worker / sched->num_workers;
+  *end = sched->num_tasks * (worker + 1) / sched->num_workers;
+}
+
+// Takes the first task of the worker's own range.
+static int pop_own(task_deque_t *deque, size_t *task) {
+  uint64_t r = atomic_load(&deque->range);
+  for (;;) {
+    uint32_t top = RANGE_TOP(r), bottom = RANGE_BOTTOM(r);
+    if (top >= bottom) {
+      return 0;
+    }
+    if (atomic_compare_exchange_weak(&deque->range, &r,
+                                     RANGE(top + 1, bottom))) {
+      *task = top;
+      return 1;
+    }
+  }
+}
+
+// Takes the back half of the victim's range. The first stolen task is
+// returned and the rest becomes the thief's own range. The thief's deque is
+// empty here, so nobody else is modifying it.
+static int steal_half(task_deque_t *victim, task_deque_t *own, size_t *task) {
+  uint64_t r = atomic_load(&victim->range);
+  for (;;) {
+    uint32_t top = RANGE_TOP(r), bottom = RANGE_BOTTOM(r);
+    if (top >= bottom) {
+      return 0;
+    }
+    uint32_t take = (bottom - top + 1) / 2;
+    if (atomic_compare_exchange_weak(&victim->range, &r,
+                                     RANGE(top, bottom - take))) {
+      *task = bottom - take;
+      atomic_store(&own->range, RANGE(bottom - take + 1, bottom));
+      return 1;
+    }
+  }
+}
+
+int scheduler_next(task_scheduler_t *sched, size_t worker, size_t *task) {
+  task_deque_t *own = &sched->deques[worker];
+  if (pop_own(own, task)) {
+    return 1;
+  }
+
+  // Tasks are never created, only moved between deques, so one full pass that
+  // finds nothing means the remaining work is already being processed. With
+  // nodes set, a first pass only looks at the worker's own node, whose
+  // deques hold input and tables that are local to it.
+  const int *node = sched->worker_node;
+  for (int pass = node ? 0 : 1; pass < 2; pass++) {
+    for (size_t i = 1; i < sched->num_workers; i++) {
+      size_t victim = (worker + i) % sched->num_workers;
+      if (pass == 0 && node[victim] != node[worker]) {
+        continue;
+      }
+      if (steal_half(&sched->deques[victim], own, task)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,352 @@
+// Lab 8 - Parallel ordering of count map entries for output
+#include "sort.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The first 8 bytes of the word, big-endian and zero-padded, next to the
+// entry. Comparing prefixes orders most pairs without touching the words;
+// words never contain NUL, so the padding cannot tie with real bytes.
+typedef struct {
+  uint64_t prefix;
+  word_count_entry_t *entry;
+} sort_item_t;
+
+// A contiguous range of the map's buckets handled by one thread.
+typedef struct {
+  UT_hash_table *tbl;
+  size_t bucket_begin;
+  size_t bucket_end;
+  sort_item_t *items; // sort: this part's run; top-k: its heap
+  size_t count;
+  size_t k;
+} part_t;
+
+static uint64_t word_prefix(const char *word, unsigned len) {
+  uint64_t prefix = 0;
+  unsigned n = len < 8 ? len : 8;
+  for (unsigned i = 0; i < n; i++) {
+    prefix |= (uint64_t)(unsigned char)word[i] << (56 - 8 * i);
+  }
+  return prefix;
+}
+
+static sort_item_t make_item(word_count_entry_t *entry) {
+  sort_item_t item = {word_prefix(entry->word, entry->hh.keylen), entry};
+  return item;
+}
+
+static int compare_items(const sort_item_t *a, const sort_item_t *b) {
+  if (a->prefix != b->prefix) {
+    return a->prefix < b->prefix ? -1 : 1;
+  }
+  return sort_func(a->entry, b->entry);
+}
+
+static int compare_items_qsort(const void *a, const void *b) {
+  return compare_items(a, b);
+}
+
+// Higher count first, then word order.
+static int compare_top(const sort_item_t *a, const sort_item_t *b) {
+  if (a->entry->count != b->entry->count) {
+    return a->entry->count > b->entry->count ? -1 : 1;
+  }
+  return compare_items(a, b);
+}
+
+static int compare_top_qsort(const void *a, const void *b) {
+  return compare_top(a, b);
+}
+
+#define FOR_EACH_ENTRY_IN_PART(part, entry)                                    \
+  for (size_t _b = (part)->bucket_begin; _b < (part)->bucket_end; _b++)        \
+    for (UT_hash_handle *_hh = (part)->tbl->buckets[_b].hh_head;               \
+         _hh && ((entry) = ELMT_FROM_HH((part)->tbl, _hh), 1);                 \
+         _hh = _hh->hh_next)
+
+// Cuts the bucket array into at most num_threads parts of equal bucket count.
+static size_t split_parts(count_map_t map, size_t num_threads, part_t **parts) {
+  UT_hash_table *tbl = map->hh.tbl;
+  size_t num_parts = num_threads ? num_threads : default_thread_count();
+  if (num_parts > tbl->num_buckets) {
+    num_parts = tbl->num_buckets;
+  }
+
+  *parts = calloc(num_parts, sizeof(part_t));
+  if (!*parts) {
+    perror("split_parts");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < num_parts; i++) {
+    (*parts)[i].tbl = tbl;
+    (*parts)[i].bucket_begin = tbl->num_buckets * i / num_parts;
+    (*parts)[i].bucket_end = tbl->num_buckets * (i + 1) / num_parts;
+  }
+  return num_parts;
+}
+
+static void run_parts(part_t *parts, size_t num_parts, void *(*fn)(void *)) {
+  pthread_t *threads = malloc(num_parts * sizeof(pthread_t));
+  if (!threads) {
+    perror("run_parts");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < num_parts; i++) {
+    pthread_create(&threads[i], NULL, fn, &parts[i]);
+  }
+  for (size_t i = 0; i < num_parts; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+}
+
+static void *collect_and_sort(void *param) {
+  part_t *part = (part_t *)param;
+  word_count_entry_t *entry;
+  size_t n = 0;
+
+  FOR_EACH_ENTRY_IN_PART(part, entry) { part->items[n++] = make_item(entry); }
+  qsort(part->items, n, sizeof(sort_item_t), compare_items_qsort);
+  return NULL;
+}
+
+typedef struct {
+  const sort_item_t *a, *b;
+  size_t len_a, len_b;
+  sort_item_t *out;
+} merge_job_t;
+
+static void *merge_runs(void *param) {
+  merge_job_t *job = (merge_job_t *)param;
+  size_t i = 0, j = 0, n = 0;
+
+  while (i < job->len_a && j < job->len_b) {
+    if (compare_items(&job->b[j], &job->a[i]) < 0) {
+      job->out[n++] = job->b[j++];
+    } else {
+      job->out[n++] = job->a[i++];
+    }
+  }
+  memcpy(job->out + n, job->a + i, (job->len_a - i) * sizeof(sort_item_t));
+  n += job->len_a - i;
+  memcpy(job->out + n, job->b + j, (job->len_b - j) * sizeof(sort_item_t));
+  return NULL;
+}
+
+word_count_entry_t **sort_entries_parallel(count_map_t map, size_t num_threads,
+                                           size_t *count) {
+  *count = HASH_COUNT(map);
+  if (*count == 0) {
+    return NULL;
+  }
+
+  part_t *parts;
+  size_t num_parts = split_parts(map, num_threads, &parts);
+  sort_item_t *items = malloc(*count * sizeof(sort_item_t));
+  sort_item_t *scratch = malloc(*count * sizeof(sort_item_t));
+
+  // Bucket counts give each part's run size up front, so the parts can fill
+  // the shared array without coordinating.
+  size_t *bounds = malloc((num_parts + 1) * sizeof(size_t));
+  if (!items || !scratch || !bounds) {
+    perror("sort_entries_parallel");
+    exit(EXIT_FAILURE);
+  }
+  bounds[0] = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    size_t n = 0;
+    for (size_t b = parts[i].bucket_begin; b < parts[i].bucket_end; b++) {
+      n += parts[i].tbl->buckets[b].count;
+    }
+    parts[i].items = items + bounds[i];
+    bounds[i + 1] = bounds[i] + n;
+  }
+  run_parts(parts, num_parts, collect_and_sort);
+
+  // Merge adjacent runs pairwise, all pairs of a round in parallel.
+  pthread_t *threads = malloc(num_parts * sizeof(pthread_t));
+  merge_job_t *jobs = malloc(num_parts * sizeof(merge_job_t));
+  if (!threads || !jobs) {
+    perror("sort_entries_parallel");
+    exit(EXIT_FAILURE);
+  }
+  size_t num_runs = num_parts;
+  while (num_runs > 1) {
+    size_t pairs = 0;
+    for (size_t r = 0; r + 1 < num_runs; r += 2) {
+      jobs[pairs] = (merge_job_t){
+          .a = items + bounds[r],
+          .len_a = bounds[r + 1] - bounds[r],
+          .b = items + bounds[r + 1],
+          .len_b = bounds[r + 2] - bounds[r + 1],
+          .out = scratch + bounds[r],
+      };
+      pthread_create(&threads[pairs], NULL, merge_runs, &jobs[pairs]);
+      pairs++;
+    }
+    if (num_runs % 2) {
+      size_t last = num_runs - 1;
+      memcpy(scratch + bounds[last], items + bounds[last],
+             (bounds[last + 1] - bounds[last]) * sizeof(sort_item_t));
+    }
+    for (size_t p = 0; p < pairs; p++) {
+      pthread_join(threads[p], NULL);
+    }
+
+    // Every merged pair becomes one run.
+    size_t runs = 0;
+    for (size_t r = 0; r < num_runs; r += 2) {
+      bounds[runs++] = bounds[r];
+    }
+    bounds[runs] = *count;
+    num_runs = runs;
+
+    sort_item_t *swap = items;
+    items = scratch;
+    scratch = swap;
+  }
+
+  word_count_entry_t **entries = malloc(*count * sizeof(word_count_entry_t *));
+  if (!entries) {
+    perror("sort_entries_parallel");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < *count; i++) {
+    entries[i] = items[i].entry;
+  }
+
+  free(jobs);
+  free(threads);
+  free(bounds);
+  free(scratch);
+  free(items);
+  free(parts);
+  return entries;
+}
+
+// Min-heap on compare_top: the root is the worst entry kept so far, and is the
+// one replaced when a better entry shows up.
+static void heap_sift_down(sort_item_t *heap, size_t n, size_t i) {
+  for (;;) {
+    size_t worst = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < n && compare_top(&heap[l], &heap[worst]) > 0) {
+      worst = l;
+    }
+    if (r < n && compare_top(&heap[r], &heap[worst]) > 0) {
+      worst = r;
+    }
+    if (worst == i) {
+      return;
+    }
+    sort_item_t tmp = heap[i];
+    heap[i] = heap[worst];
+    heap[worst] = tmp;
+    i = worst;
+  }
+}
+
+static void heap_sift_up(sort_item_t *heap, size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (compare_top(&heap[i], &heap[parent]) <= 0) {
+      return;
+    }
+    sort_item_t tmp = heap[i];
+    heap[i] = heap[parent];
+    heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+// Offers item to a heap holding at most k items.
+static void heap_offer(sort_item_t *heap, size_t *n, size_t k,
+                       const sort_item_t *item) {
+  if (*n < k) {
+    heap[*n] = *item;
+    heap_sift_up(heap, (*n)++);
+  } else if (compare_top(item, &heap[0]) < 0) {
+    heap[0] = *item;
+    heap_sift_down(heap, *n, 0);
+  }
+}
+
+static void *collect_top_k(void *param) {
+  part_t *part = (part_t *)param;
+  word_count_entry_t *entry;
+
+  FOR_EACH_ENTRY_IN_PART(part, entry) {
+    // Cheap reject before building the item: a full heap only takes counts at
+    // least as high as its worst one.
+    if (part->count == part->k && entry->count < part->items[0].entry->count) {
+      continue;
+    }
+    sort_item_t item = make_item(entry);
+    heap_offer(part->items, &part->count, part->k, &item);
+  }
+  return NULL;
+}
+
+word_count_entry_t **top_k_entries(count_map_t map, size_t k,
+                                   size_t num_threads, size_t *count) {
+  *count = 0;
+  if (HASH_COUNT(map) == 0 || k == 0) {
+    return NULL;
+  }
+
+  // No heap ever holds more than the map has, however large --top is.
+  if (k > HASH_COUNT(map)) {
+    k = HASH_COUNT(map);
+  }
+
+  part_t *parts;
+  size_t num_parts = split_parts(map, num_threads, &parts);
+  for (size_t i = 0; i < num_parts; i++) {
+    parts[i].items = malloc(k * sizeof(sort_item_t));
+    if (!parts[i].items) {
+      perror("top_k_entries");
+      exit(EXIT_FAILURE);
+    }
+    parts[i].k = k;
+  }
+  run_parts(parts, num_parts, collect_top_k);
+
+  // The overall top k is among the per-part top k.
+  sort_item_t *heap = malloc(k * sizeof(sort_item_t));
+  if (!heap) {
+    perror("top_k_entries");
+    exit(EXIT_FAILURE);
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    for (size_t j = 0; j < parts[i].count; j++) {
+      heap_offer(heap, &n, k, &parts[i].items[j]);
+    }
+    free(parts[i].items);
+  }
+  free(parts);
+
+  qsort(heap, n, sizeof(sort_item_t), compare_top_qsort);
+  word_count_entry_t **entries = malloc(n * sizeof(word_count_entry_t *));
+  if (!entries) {
+    perror("top_k_entries");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < n; i++) {
+    entries[i] = heap[i].entry;
+  }
+  free(heap);
+
+  *count = n;
+  return entries;
+}
+
+void print_entries(word_count_entry_t **entries, size_t count) {
+  printf("%-32s%-10s\n", "Word", "Count");
+  for (size_t i = 0; i < count; i++) {
+    printf("%-32.*s%-10zu\n", (int)entries[i]->hh.keylen, entries[i]->word,
+           entries[i]->count);
+  }
+}
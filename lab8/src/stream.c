@@ -0,0 +1,538 @@
+// Lab 8 - Continuous word counting over a stream with periodic snapshots
+#include "stream.h"
+#include "sort.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Chunks read ahead per worker before the reader blocks.
+#define STREAM_QUEUE_DEPTH 4
+
+static volatile sig_atomic_t stop_requested = 0;
+
+void stream_stop(void) { stop_requested = 1; }
+
+typedef struct {
+  char *data; // malloc'd, owned by the queue until a worker takes it
+  size_t len;
+} stream_chunk_t;
+
+// The counts of one epoch. The input chunks are freed as soon as they are
+// counted, so the table's words are copies kept in words.
+typedef struct {
+  count_map_t map;
+  arena_t *words;
+  size_t total;
+} stream_delta_t;
+
+typedef struct stream stream_t;
+
+typedef struct {
+  pthread_t thread;
+  stream_t *stream;
+  stream_delta_t deltas[2];
+  int active; // the delta being filled; only the worker itself changes it
+  _Atomic uint64_t seen_epoch;
+  _Atomic int exited;
+} stream_worker_t;
+
+// The top words at the end of one epoch. entries are copies, so only their
+// word, count and hh.keylen are set; the words point into the totals' arena,
+// which lives as long as the stream.
+typedef struct {
+  uint64_t epoch;
+  double seconds;
+  size_t total_words;
+  size_t distinct_words;
+  size_t count;
+  // Grows to min(top_k, distinct words) as the totals grow, not to top_k up
+  // front, since --top can be far larger than the vocabulary.
+  size_t capacity;
+  word_count_entry_t *entries;
+  word_count_entry_t **ptrs; // ptrs[i] == &entries[i], for write_entries
+} stream_snapshot_t;
+
+struct stream {
+  const stream_options_t *opts;
+  size_t top_k;
+  unsigned interval_ms;
+
+  // Chunk queue between the reader and the workers, and the publisher's
+  // sleep. Workers also check for a new epoch under this lock before they
+  // wait, so bumping the epoch under it cannot miss an idle worker.
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  pthread_cond_t publisher_wake;
+  stream_chunk_t *queue;
+  size_t queue_cap;
+  size_t queue_head;
+  size_t queue_len;
+  int input_done;
+  int publisher_stop;
+
+  _Atomic uint64_t epoch;
+  stream_worker_t *workers;
+  size_t num_workers;
+
+  // Only the publisher touches these.
+  count_map_t totals;
+  arena_t *total_words;
+  size_t total_count;
+  double start;
+
+  // Double-buffered snapshots. The publisher fills the slot that is not
+  // current, once no reader holds it, and then makes it current.
+  stream_snapshot_t snapshots[2];
+  _Atomic int current;
+  _Atomic int readers[2];
+
+  out_buf_t out;
+};
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_ms(unsigned ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+static void delta_init(stream_delta_t *delta) {
+  delta->map = NULL;
+  delta->words = arena_create();
+  delta->total = 0;
+}
+
+static void delta_destroy(stream_delta_t *delta) {
+  delete_table(delta->map);
+  arena_release(delta->words);
+}
+
+static void delta_clear(stream_delta_t *delta) {
+  delta_destroy(delta);
+  delta_init(delta);
+}
+
+// Called by a worker, with the queue lock held, before it takes a chunk or
+// waits for one.
+static void ack_epoch(stream_worker_t *w) {
+  // Acquire pairs with the publisher's release, so the delta it emptied
+  // during the last epoch is seen empty.
+  uint64_t epoch =
+      atomic_load_explicit(&w->stream->epoch, memory_order_acquire);
+  if (epoch != atomic_load_explicit(&w->seen_epoch, memory_order_relaxed)) {
+    w->active ^= 1;
+    // Release hands the full delta over with everything written to it.
+    atomic_store_explicit(&w->seen_epoch, epoch, memory_order_release);
+  }
+}
+
+static int queue_pop(stream_t *s, stream_worker_t *w, stream_chunk_t *chunk) {
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    ack_epoch(w);
+    if (s->queue_len > 0) {
+      *chunk = s->queue[s->queue_head];
+      s->queue_head = (s->queue_head + 1) % s->queue_cap;
+      s->queue_len--;
+      pthread_cond_signal(&s->not_full);
+      pthread_mutex_unlock(&s->lock);
+      return 1;
+    }
+    if (s->input_done) {
+      pthread_mutex_unlock(&s->lock);
+      return 0;
+    }
+    pthread_cond_wait(&s->not_empty, &s->lock);
+  }
+}
+
+static void queue_push(stream_t *s, char *data, size_t len) {
+  pthread_mutex_lock(&s->lock);
+  while (s->queue_len == s->queue_cap) {
+    pthread_cond_wait(&s->not_full, &s->lock);
+  }
+  size_t tail = (s->queue_head + s->queue_len) % s->queue_cap;
+  s->queue[tail].data = data;
+  s->queue[tail].len = len;
+  s->queue_len++;
+  pthread_cond_signal(&s->not_empty);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void count_stream_tokens(void *ctx, token_t *tokens, size_t n) {
+  stream_worker_t *w = ctx;
+  stream_delta_t *delta = &w->deltas[w->active];
+  intern_tokens(tokens, n);
+
+  for (size_t i = 0; i < n; i++) {
+    const token_t *t = &tokens[i];
+    word_count_entry_t *e = NULL;
+    HASH_FIND_BYHASHVALUE(hh, delta->map, t->word, t->len, t->hash, e);
+    if (e) {
+      e->count++;
+      continue;
+    }
+    char *copy = arena_alloc(delta->words, t->len);
+    memcpy(copy, t->word, t->len);
+    e = create_entry(copy, 1);
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, delta->map, e->word, t->len, t->hash, e);
+  }
+  delta->total += n;
+}
+
+static void *stream_worker_func(void *arg) {
+  stream_worker_t *w = arg;
+  stream_chunk_t chunk;
+
+  while (queue_pop(w->stream, w, &chunk)) {
+    text_span_t span = {chunk.data, chunk.data + chunk.len};
+    tokenize_span(&span, count_stream_tokens, w);
+    free(chunk.data);
+  }
+
+  // Both deltas now belong to the publisher.
+  atomic_store_explicit(&w->exited, 1, memory_order_release);
+  return NULL;
+}
+
+// Adds a delta to the totals and empties it. Publisher only.
+static void merge_delta(stream_t *s, stream_delta_t *delta) {
+  word_count_entry_t *current, *tmp;
+  HASH_ITER(hh, delta->map, current, tmp) {
+    unsigned len = current->hh.keylen;
+    unsigned hashv = current->hh.hashv;
+    word_count_entry_t *e = NULL;
+    HASH_FIND_BYHASHVALUE(hh, s->totals, current->word, len, hashv, e);
+    if (e) {
+      e->count += current->count;
+      continue;
+    }
+    char *copy = arena_alloc(s->total_words, len);
+    memcpy(copy, current->word, len);
+    e = create_entry(copy, current->count);
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, s->totals, e->word, len, hashv, e);
+  }
+  s->total_count += delta->total;
+  delta_clear(delta);
+}
+
+// Makes snap hold at least count entries. Only called on the slot no reader
+// has pinned, so moving the arrays is safe.
+static void snapshot_reserve(stream_snapshot_t *snap, size_t count) {
+  if (count <= snap->capacity) {
+    return;
+  }
+  size_t capacity = snap->capacity * 2 > count ? snap->capacity * 2 : count;
+  word_count_entry_t *entries =
+      realloc(snap->entries, capacity * sizeof(word_count_entry_t));
+  word_count_entry_t **ptrs =
+      realloc(snap->ptrs, capacity * sizeof(word_count_entry_t *));
+  if (!entries || !ptrs) {
+    perror("stream snapshot");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < capacity; i++) {
+    ptrs[i] = &entries[i];
+  }
+  snap->entries = entries;
+  snap->ptrs = ptrs;
+  snap->capacity = capacity;
+}
+
+// Starts a new epoch, collects what every worker counted in the last one,
+// and publishes a snapshot of the totals. Publisher only.
+static void publish(stream_t *s) {
+  pthread_mutex_lock(&s->lock);
+  uint64_t epoch =
+      atomic_fetch_add_explicit(&s->epoch, 1, memory_order_release) + 1;
+  pthread_cond_broadcast(&s->not_empty);
+  pthread_mutex_unlock(&s->lock);
+
+  for (size_t i = 0; i < s->num_workers; i++) {
+    stream_worker_t *w = &s->workers[i];
+    // A busy worker switches after its current chunk, an idle one at once.
+    while (atomic_load_explicit(&w->seen_epoch, memory_order_acquire) !=
+               epoch &&
+           !atomic_load_explicit(&w->exited, memory_order_acquire)) {
+      sched_yield();
+    }
+    if (atomic_load_explicit(&w->exited, memory_order_acquire)) {
+      merge_delta(s, &w->deltas[0]);
+      merge_delta(s, &w->deltas[1]);
+    } else {
+      merge_delta(s, &w->deltas[w->active ^ 1]);
+    }
+  }
+
+  int slot = 1 - atomic_load(&s->current);
+  while (atomic_load(&s->readers[slot]) > 0) {
+    sched_yield();
+  }
+  stream_snapshot_t *snap = &s->snapshots[slot];
+  size_t count;
+  word_count_entry_t **top = top_k_entries(s->totals, s->top_k, 1, &count);
+  snapshot_reserve(snap, count);
+  for (size_t i = 0; i < count; i++) {
+    snap->entries[i] = *top[i];
+  }
+  free(top);
+  snap->count = count;
+  snap->epoch = epoch;
+  snap->seconds = now_sec() - s->start;
+  snap->total_words = s->total_count;
+  snap->distinct_words = HASH_COUNT(s->totals);
+  atomic_store(&s->current, slot);
+}
+
+// Pins the current snapshot until snapshot_release. Never blocks.
+static int snapshot_acquire(stream_t *s) {
+  for (;;) {
+    int slot = atomic_load(&s->current);
+    atomic_fetch_add(&s->readers[slot], 1);
+    // If the publisher switched slots in between, it may already be
+    // rewriting this one; try again.
+    if (atomic_load(&s->current) == slot) {
+      return slot;
+    }
+    atomic_fetch_sub(&s->readers[slot], 1);
+  }
+}
+
+static void snapshot_release(stream_t *s, int slot) {
+  atomic_fetch_sub(&s->readers[slot], 1);
+}
+
+static void print_snapshot(stream_t *s) {
+  int slot = snapshot_acquire(s);
+  const stream_snapshot_t *snap = &s->snapshots[slot];
+
+  // Binary dumps are simply written back to back.
+  if (s->opts->format != OUTPUT_BINARY) {
+    char line[160];
+    int n = snprintf(line, sizeof(line),
+                     "# snapshot %llu: %zu words, %zu distinct, %.3f s\n",
+                     (unsigned long long)snap->epoch, snap->total_words,
+                     snap->distinct_words, snap->seconds);
+    out_bytes(&s->out, line, (size_t)n);
+  }
+  out_flush(&s->out);
+  write_entries(&s->out, snap->ptrs, snap->count, s->opts->format);
+
+  snapshot_release(s, slot);
+}
+
+static void *publisher_func(void *arg) {
+  stream_t *s = arg;
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    deadline.tv_sec += s->interval_ms / 1000;
+    deadline.tv_nsec += (long)(s->interval_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (!s->publisher_stop &&
+           pthread_cond_timedwait(&s->publisher_wake, &s->lock, &deadline) !=
+               ETIMEDOUT) {
+    }
+    if (s->publisher_stop) {
+      break;
+    }
+    pthread_mutex_unlock(&s->lock);
+    publish(s);
+    print_snapshot(s);
+    pthread_mutex_lock(&s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+// Returns one past the last newline in buf, or, if there is none and the
+// buffer is full, one past the last space or tab so that no word is split.
+// Returns 0 if the chunk should wait for more input.
+static size_t chunk_end(const char *buf, size_t len, size_t cap) {
+  for (size_t i = len; i > 0; i--) {
+    if (buf[i - 1] == '\n') {
+      return i;
+    }
+  }
+  if (len < cap) {
+    return 0;
+  }
+  for (size_t i = len; i > 0; i--) {
+    if (buf[i - 1] == ' ' || buf[i - 1] == '\t') {
+      return i;
+    }
+  }
+  return len;
+}
+
+// Reads fd into chunks for the workers until it ends or a stop is requested.
+// Returns 0, or -1 with errno set.
+static int read_input(stream_t *s, int fd) {
+  char *buf = malloc(STREAM_CHUNK_SIZE);
+  size_t len = 0;
+  off_t offset = 0;
+  int ret = 0;
+
+  while (!stop_requested) {
+    ssize_t n = read(fd, buf + len, STREAM_CHUNK_SIZE - len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ret = -1;
+      break;
+    }
+    if (n == 0) {
+      if (!s->opts->follow) {
+        break;
+      }
+      // Start over if the file was truncated, as log rotation does.
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < offset) {
+        lseek(fd, 0, SEEK_SET);
+        offset = 0;
+        len = 0;
+        continue;
+      }
+      sleep_ms(STREAM_FOLLOW_POLL_MS);
+      continue;
+    }
+    offset += n;
+    len += (size_t)n;
+
+    size_t end = chunk_end(buf, len, STREAM_CHUNK_SIZE);
+    if (end == 0) {
+      continue;
+    }
+    char *next = malloc(STREAM_CHUNK_SIZE);
+    memcpy(next, buf + end, len - end);
+    queue_push(s, buf, end);
+    buf = next;
+    len -= end;
+  }
+
+  if (len > 0 && ret == 0) {
+    queue_push(s, buf, len);
+  } else {
+    free(buf);
+  }
+  return ret;
+}
+
+int stream_count(int fd, const stream_options_t *opts) {
+  stream_t s;
+  memset(&s, 0, sizeof(s));
+  s.opts = opts;
+  s.top_k = opts->top_k ? opts->top_k : DEFAULT_STREAM_TOP_K;
+  s.interval_ms =
+      opts->interval_ms ? opts->interval_ms : DEFAULT_STREAM_INTERVAL_MS;
+  s.num_workers =
+      opts->num_threads ? opts->num_threads : default_thread_count();
+  s.start = now_sec();
+  stop_requested = 0;
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_cond_init(&s.not_empty, NULL);
+  pthread_cond_init(&s.not_full, NULL);
+  pthread_cond_init(&s.publisher_wake, &attr);
+  pthread_condattr_destroy(&attr);
+
+  s.queue_cap = s.num_workers * STREAM_QUEUE_DEPTH;
+  s.queue = malloc(s.queue_cap * sizeof(stream_chunk_t));
+  s.total_words = arena_create();
+  char *out_buf = malloc(OUTPUT_BUFFER_SIZE);
+  if (!out_buf) {
+    perror("stream output");
+    exit(EXIT_FAILURE);
+  }
+  out_buf_init(&s.out, STDOUT_FILENO, out_buf, OUTPUT_BUFFER_SIZE);
+
+  s.workers = calloc(s.num_workers, sizeof(stream_worker_t));
+  for (size_t i = 0; i < s.num_workers; i++) {
+    s.workers[i].stream = &s;
+    delta_init(&s.workers[i].deltas[0]);
+    delta_init(&s.workers[i].deltas[1]);
+  }
+
+  // Stop signals go to the reader, whose read() they interrupt.
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  for (size_t i = 0; i < s.num_workers; i++) {
+    pthread_create(&s.workers[i].thread, NULL, stream_worker_func,
+                   &s.workers[i]);
+  }
+  pthread_t publisher;
+  pthread_create(&publisher, NULL, publisher_func, &s);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  int ret = read_input(&s, fd);
+  int saved_errno = errno;
+
+  pthread_mutex_lock(&s.lock);
+  s.input_done = 1;
+  pthread_cond_broadcast(&s.not_empty);
+  pthread_mutex_unlock(&s.lock);
+  for (size_t i = 0; i < s.num_workers; i++) {
+    pthread_join(s.workers[i].thread, NULL);
+  }
+
+  pthread_mutex_lock(&s.lock);
+  s.publisher_stop = 1;
+  pthread_cond_signal(&s.publisher_wake);
+  pthread_mutex_unlock(&s.lock);
+  pthread_join(publisher, NULL);
+
+  // Every worker has exited, so this collects everything still counted.
+  publish(&s);
+  print_snapshot(&s);
+  if (ret == 0 && out_flush(&s.out) == -1) {
+    ret = -1;
+    saved_errno = errno;
+  }
+
+  for (size_t i = 0; i < s.num_workers; i++) {
+    delta_destroy(&s.workers[i].deltas[0]);
+    delta_destroy(&s.workers[i].deltas[1]);
+  }
+  free(s.workers);
+  for (int i = 0; i < 2; i++) {
+    free(s.snapshots[i].entries);
+    free(s.snapshots[i].ptrs);
+  }
+  delete_table(s.totals);
+  arena_release(s.total_words);
+  free(s.queue);
+  free(out_buf);
+  pthread_cond_destroy(&s.publisher_wake);
+  pthread_cond_destroy(&s.not_full);
+  pthread_cond_destroy(&s.not_empty);
+  pthread_mutex_destroy(&s.lock);
+
+  errno = saved_errno;
+  return ret;
+}
@@ -0,0 +1,118 @@
+// Lab 8 - Zero-copy tokenizer over memory-mapped input files
+#include "tokenizer.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int map_file(const char *path, mapped_file_t *file) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  file->data = NULL;
+  file->size = (size_t)st.st_size;
+  if (file->size > 0) {
+    void *p = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    file->data = p;
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  return 0;
+}
+
+void unmap_file(mapped_file_t *file) {
+  if (file->data) {
+    munmap((void *)file->data, file->size);
+  }
+  file->data = NULL;
+  file->size = 0;
+}
+
+size_t split_spans(const mapped_file_t *files, size_t num_files,
+                   size_t span_size, text_span_t **spans) {
+  size_t capacity = 16;
+  size_t count = 0;
+  *spans = malloc(capacity * sizeof(text_span_t));
+
+  for (size_t f = 0; f < num_files; f++) {
+    const char *p = files[f].data;
+    const char *end = p + files[f].size;
+
+    while (p < end) {
+      const char *stop = end;
+      if ((size_t)(end - p) > span_size) {
+        // Extend to just past the next newline so no line is split.
+        const char *nl = memchr(p + span_size, '\n', end - (p + span_size));
+        stop = nl ? nl + 1 : end;
+      }
+
+      if (count == capacity) {
+        capacity *= 2;
+        *spans = realloc(*spans, capacity * sizeof(text_span_t));
+      }
+      (*spans)[count].begin = p;
+      (*spans)[count].end = stop;
+      count++;
+      p = stop;
+    }
+  }
+
+  return count;
+}
+
+static unsigned char word_chars[256];
+
+static void init_word_chars(void) {
+  for (int c = 0; c < 256; c++) {
+    word_chars[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                    (c >= '0' && c <= '9') || c == '_' || c == '\'' ||
+                    c >= 0x80;
+  }
+}
+
+void tokenize_span(const text_span_t *span, token_fn_t fn, void *ctx) {
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, init_word_chars);
+
+  const unsigned char *p = (const unsigned char *)span->begin;
+  const unsigned char *end = (const unsigned char *)span->end;
+  token_t batch[TOKEN_BATCH_SIZE];
+  size_t n = 0;
+
+  while (p < end) {
+    while (p < end && !word_chars[*p]) {
+      p++;
+    }
+    const unsigned char *start = p;
+    while (p < end && word_chars[*p]) {
+      p++;
+    }
+    if (p > start) {
+      batch[n].word = (const char *)start;
+      batch[n].len = (uint32_t)(p - start);
+      if (++n == TOKEN_BATCH_SIZE) {
+        fn(ctx, batch, n);
+        n = 0;
+      }
+    }
+  }
+  if (n > 0) {
+    fn(ctx, batch, n);
+  }
+}
@@ -0,0 +1,105 @@
+// Lab 8 - Hash functions that can back uthash's HASH_FUNCTION hook
+#include "word_hash.h"
+#include "uthash.h"
+#include <stdint.h>
+#include <string.h>
+
+unsigned hash_jen(const void *key, size_t len) {
+  unsigned hashv;
+  HASH_JEN(key, len, hashv);
+  return hashv;
+}
+
+unsigned hash_fnv1a(const void *key, size_t len) {
+  const uint8_t *p = key;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+static const uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+// 64x64 -> 128 multiply, folded back to 64 bits.
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_r8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t wy_r4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// 1 to 3 bytes: first, middle and last byte.
+static inline uint64_t wy_r3(const uint8_t *p, size_t k) {
+  return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static uint64_t wyhash64(const void *key, size_t len, uint64_t seed) {
+  const uint8_t *p = key;
+  uint64_t a, b;
+
+  seed ^= wy_mix(seed ^ wyp[0], wyp[1]);
+  if (len <= 16) {
+    // Most words land here: two overlapping loads cover the whole key.
+    if (len >= 4) {
+      a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = wy_r3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wy_mix(wy_r8(p) ^ wyp[1], wy_r8(p + 8) ^ seed);
+        see1 = wy_mix(wy_r8(p + 16) ^ wyp[2], wy_r8(p + 24) ^ see1);
+        see2 = wy_mix(wy_r8(p + 32) ^ wyp[3], wy_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wy_mix(wy_r8(p) ^ wyp[1], wy_r8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
+  }
+
+  a ^= wyp[1];
+  b ^= seed;
+  __uint128_t r = (__uint128_t)a * b;
+  a = (uint64_t)r;
+  b = (uint64_t)(r >> 64);
+  return wy_mix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+unsigned hash_wyhash(const void *key, size_t len) {
+  uint64_t h = wyhash64(key, len, 0);
+  return (unsigned)(h ^ (h >> 32));
+}
+
+const word_hash_t word_hashes[] = {
+    {"jen", hash_jen},
+    {"fnv1a", hash_fnv1a},
+    {"wyhash", hash_wyhash},
+};
+
+const size_t num_word_hashes = sizeof(word_hashes) / sizeof(word_hashes[0]);
@@ -0,0 +1,693 @@
+// Load generator for server.c: holds many connections open at once from a
+// single thread and pushes fixed-size messages through all of them.
+//
+// For each connection count it runs one round:
+//   1. open all connections and wait until every one is established,
+//   2. send messages_per_conn messages of msg_size bytes on each, then
+//      shut down the sending side,
+//   3. wait until the server has closed every connection. The server only
+//      closes after it has read everything, so at that point every message
+//      has been handled.
+// The time of steps 2 and 3 gives the messages/sec the server sustained with
+// that many clients connected.
+//
+// With -r it measures connection rate instead. Client threads keep a fixed
+// number of connections in flight, and each connection connects, sends its
+// messages, shuts down and waits for the server to close. As soon as one
+// finishes, the next one starts. The time from connect() to the server's
+// close is one sample. It covers the handshake, the wait in the accept
+// queue, accept itself and handling the data. The reported numbers are the
+// connection rate and the percentiles of these samples. The -c values are
+// then the numbers of connections in flight.
+//
+// -w starts the connections in waves instead: -c of them at once, and the
+// next wave only when all of those have finished. -e takes the sample at
+// the first byte echoed back by a server running with -e.
+//
+// With -U it sends UDP datagrams to a server running with -m udp instead.
+// -c sockets each send their messages, handed to the kernel in sendmmsg
+// batches of UDP_BATCH, and nothing is acknowledged. The bench only knows
+// what it sent; the server's statistics at exit tell how many arrived and
+// in how many receive calls.
+//
+// The server reads at most BUF_SIZE - 1 = 63 bytes at a time and counts every
+// read as one message, so with the default message size of 63 its message
+// count matches ours exactly. With -F every message goes out as a frame, a
+// 4-byte length and then the data, for a server running with -F; then any
+// size works. -s takes a list of sizes and -B fixes the bytes per connection
+// instead of the message count, for sweeping sizes from tiny to huge. Run
+// the server with -q, or it measures the terminal.
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORT 8000
+#define ADDR "127.0.0.1"
+#define BUF_SIZE 64
+#define MAX_EVENTS 256
+#define FRAME_HEADER_SIZE 4
+// Bytes handed to a single write.
+#define WRITE_CHUNK (64 * 1024)
+// Datagrams handed to one sendmmsg with -U.
+#define UDP_BATCH 64
+
+#define DEFAULT_CONN_COUNTS "1,10,100,1000"
+#define DEFAULT_MESSAGES 1000
+#define DEFAULT_MSG_SIZE "63"
+#define DEFAULT_STORM_CONNS 20000
+
+#define handle_error(msg)                                                      \
+  do {                                                                         \
+    perror(msg);                                                               \
+    exit(EXIT_FAILURE);                                                        \
+  } while (0)
+
+enum conn_state { CONNECTING, SENDING, DRAINING, DONE };
+
+struct conn {
+  int fd;
+  enum conn_state state;
+  size_t sent;
+  double start;      // when connect() was called, in connection rate mode
+  double first_byte; // when the first echoed byte arrived, or 0
+};
+
+struct round_result {
+  size_t connected;
+  size_t failed;
+  double connect_seconds;
+  double transfer_seconds;
+};
+
+// Messages, framed with -F, are laid out back to back in this buffer; every
+// connection sends slices of it. Letters only, since the server prints them
+// with %s.
+char *payload;
+size_t payload_len;    // bytes each connection sends
+size_t payload_stride; // bytes per message, header included
+int framed = 0;
+
+double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void raise_fd_limit(void) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+      perror("setrlimit");
+    }
+  }
+}
+
+void fill_payload(size_t messages, size_t msg_size) {
+  size_t header = framed ? FRAME_HEADER_SIZE : 0;
+  payload_stride = header + msg_size;
+  payload_len = messages * payload_stride;
+  // A window of WRITE_CHUNK plus one message is enough: every write starts
+  // at offset sent % payload_stride, so it lines up with message boundaries.
+  size_t len = payload_len < WRITE_CHUNK + payload_stride
+                   ? payload_len
+                   : WRITE_CHUNK + payload_stride;
+  free(payload);
+  payload = malloc(len);
+  if (payload == NULL) {
+    handle_error("malloc");
+  }
+  uint32_t frame_len = htonl((uint32_t)msg_size);
+  for (size_t i = 0; i < len; i += payload_stride) {
+    size_t n = len - i < payload_stride ? len - i : payload_stride;
+    memset(payload + i, 'a' + (int)(i / payload_stride % 26), n);
+    memcpy(payload + i, &frame_len, n < header ? n : header);
+  }
+}
+
+// Writes until the socket buffer is full or everything is sent. Returns -1 if
+// the connection failed.
+int send_some(struct conn *c) {
+  while (c->sent < payload_len) {
+    size_t offset = c->sent % payload_stride;
+    size_t len = payload_len - c->sent;
+    if (len > WRITE_CHUNK) {
+      len = WRITE_CHUNK;
+    }
+    ssize_t n = write(c->fd, payload + offset, len);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    c->sent += (size_t)n;
+  }
+  if (shutdown(c->fd, SHUT_WR) == -1) {
+    return -1;
+  }
+  c->state = DRAINING;
+  return 0;
+}
+
+// Reads and drops whatever the server sent. Returns 1 once the server has
+// closed the connection.
+int server_closed(struct conn *c) {
+  char buf[BUF_SIZE];
+  for (;;) {
+    ssize_t n = read(c->fd, buf, sizeof(buf));
+    if (n == 0) {
+      return 1;
+    }
+    if (n > 0 && c->first_byte == 0) {
+      c->first_byte = now_seconds();
+    }
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      return 1; // reset counts as closed
+    }
+  }
+}
+
+void finish(struct conn *c, size_t *remaining) {
+  close(c->fd);
+  c->state = DONE;
+  (*remaining)--;
+}
+
+// Starts a non-blocking connect and registers the socket with epfd.
+void start_connect(int epfd, const struct sockaddr_in *addr, struct conn *c) {
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c->fd == -1) {
+    handle_error("socket");
+  }
+  c->state = CONNECTING;
+  c->sent = 0;
+  c->start = now_seconds();
+  c->first_byte = 0;
+  if (connect(c->fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1 &&
+      errno != EINPROGRESS) {
+    handle_error("connect");
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+    handle_error("epoll_ctl");
+  }
+}
+
+struct round_result run_round(const struct sockaddr_in *addr, size_t count) {
+  struct round_result r = {0};
+  struct conn *conns = calloc(count, sizeof(struct conn));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (conns == NULL || epfd == -1) {
+    handle_error("round setup");
+  }
+
+  // 1. Connect everything. Established connections get no further events
+  //    until they are needed, since the edge has already been consumed.
+  double start = now_seconds();
+  size_t remaining = count;
+  for (size_t i = 0; i < count; i++) {
+    start_connect(epfd, addr, &conns[i]);
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  size_t connecting = count;
+  while (connecting > 0) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      handle_error("epoll_wait");
+    }
+    for (int i = 0; i < n; i++) {
+      struct conn *c = events[i].data.ptr;
+      if (c->state != CONNECTING) {
+        continue;
+      }
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      connecting--;
+      if (err != 0) {
+        r.failed++;
+        finish(c, &remaining);
+      } else {
+        r.connected++;
+        c->state = SENDING;
+      }
+    }
+  }
+  r.connect_seconds = now_seconds() - start;
+
+  // 2. and 3. Send on every connection, then wait for all of them to close.
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++) {
+    struct conn *c = &conns[i];
+    if (c->state == SENDING && send_some(c) == -1) {
+      r.failed++;
+      finish(c, &remaining);
+    }
+  }
+  while (remaining > 0) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      handle_error("epoll_wait");
+    }
+    for (int i = 0; i < n; i++) {
+      struct conn *c = events[i].data.ptr;
+      if (c->state == SENDING && (events[i].events & EPOLLOUT) &&
+          send_some(c) == -1) {
+        r.failed++;
+        finish(c, &remaining);
+        continue;
+      }
+      if (c->state != DONE && (events[i].events & (EPOLLIN | EPOLLHUP)) &&
+          server_closed(c)) {
+        if (c->state == SENDING) {
+          r.failed++; // closed before it got all our data
+        }
+        finish(c, &remaining);
+      }
+    }
+  }
+  r.transfer_seconds = now_seconds() - start;
+
+  close(epfd);
+  free(conns);
+  return r;
+}
+
+struct storm_args {
+  const struct sockaddr_in *addr;
+  size_t in_flight;
+  size_t total;
+  int waves;         // start in_flight connections at once, then wait for all
+  int first_byte;    // sample connect-to-first-echo instead of -to-close
+  double *latencies; // one per completed connection
+  size_t completed;
+  size_t failed;
+};
+
+// One client thread of the connection rate mode.
+void *run_storm(void *arg) {
+  struct storm_args *a = arg;
+  struct conn *conns = calloc(a->in_flight, sizeof(struct conn));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (conns == NULL || epfd == -1) {
+    handle_error("storm setup");
+  }
+
+  size_t launched = 0;
+  size_t finished = 0;
+  struct epoll_event events[MAX_EVENTS];
+  while (launched < a->total || finished < launched) {
+    // In waves, the next burst starts once the last one has finished.
+    // Otherwise only the first round starts here and every slot is
+    // refilled as soon as its connection ends.
+    if (finished == launched) {
+      for (size_t i = 0; i < a->in_flight && launched < a->total; i++) {
+        start_connect(epfd, a->addr, &conns[i]);
+        launched++;
+      }
+    }
+
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      handle_error("epoll_wait");
+    }
+    for (int i = 0; i < n; i++) {
+      struct conn *c = events[i].data.ptr;
+      int failed = 0;
+      int closed = 0;
+      if (c->state == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err == 0) {
+          c->state = SENDING;
+        } else if (err != EINPROGRESS) {
+          failed = 1;
+        }
+      }
+      if (!failed && c->state == SENDING && send_some(c) == -1) {
+        failed = 1;
+      }
+      if (!failed && c->state != CONNECTING) {
+        closed = server_closed(c);
+        // Closed before it took all our data, or without echoing any.
+        failed = closed && (c->state == SENDING ||
+                            (a->first_byte && c->first_byte == 0));
+      }
+      if (failed) {
+        a->failed++;
+      } else if (closed) {
+        double end = a->first_byte ? c->first_byte : now_seconds();
+        a->latencies[a->completed++] = end - c->start;
+      } else {
+        continue;
+      }
+
+      close(c->fd);
+      finished++;
+      if (!a->waves && launched < a->total) {
+        start_connect(epfd, a->addr, c);
+        launched++;
+      }
+    }
+  }
+
+  close(epfd);
+  free(conns);
+  return NULL;
+}
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// The q-quantile of n sorted samples, in microseconds.
+double percentile_us(const double *sorted, size_t n, double q) {
+  if (n == 0) {
+    return 0;
+  }
+  return sorted[(size_t)(q * (double)(n - 1))] * 1e6;
+}
+
+// Runs total connections through num_threads client threads with in_flight
+// of them open at any time, and prints one result line.
+void run_storm_round(const struct sockaddr_in *addr, size_t in_flight,
+                     size_t total, size_t num_threads, int waves,
+                     int first_byte) {
+  struct storm_args *args = calloc(num_threads, sizeof(struct storm_args));
+  pthread_t *tids = calloc(num_threads, sizeof(pthread_t));
+  double *latencies = malloc(total * sizeof(double));
+  if (args == NULL || tids == NULL || latencies == NULL) {
+    handle_error("malloc");
+  }
+
+  double start = now_seconds();
+  size_t first = 0;
+  for (size_t t = 0; t < num_threads; t++) {
+    struct storm_args *a = &args[t];
+    a->addr = addr;
+    a->in_flight = (in_flight + num_threads - 1 - t) / num_threads;
+    a->total = (total + num_threads - 1 - t) / num_threads;
+    a->waves = waves;
+    a->first_byte = first_byte;
+    a->latencies = latencies + first;
+    first += a->total;
+    if (a->in_flight == 0) {
+      a->in_flight = 1;
+    }
+    int s = pthread_create(&tids[t], NULL, run_storm, a);
+    if (s != 0) {
+      errno = s;
+      handle_error("pthread_create");
+    }
+  }
+
+  // Gather every thread's samples at the front of the array.
+  size_t completed = 0;
+  size_t failed = 0;
+  for (size_t t = 0; t < num_threads; t++) {
+    pthread_join(tids[t], NULL);
+    memmove(latencies + completed, args[t].latencies,
+            args[t].completed * sizeof(double));
+    completed += args[t].completed;
+    failed += args[t].failed;
+  }
+  double seconds = now_seconds() - start;
+
+  qsort(latencies, completed, sizeof(double), compare_doubles);
+  printf("%8zu %8zu %8zu %10.3f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+         in_flight, completed, failed, seconds, (double)completed / seconds,
+         percentile_us(latencies, completed, 0.5),
+         percentile_us(latencies, completed, 0.99),
+         percentile_us(latencies, completed, 0.999),
+         percentile_us(latencies, completed, 1.0));
+  fflush(stdout);
+
+  free(latencies);
+  free(tids);
+  free(args);
+}
+
+// Sends per_sock datagrams of msg_size bytes from each of count UDP sockets,
+// a batch per socket in turn, and prints one result line.
+void run_udp_round(const struct sockaddr_in *addr, size_t count,
+                   size_t per_sock, size_t msg_size) {
+  int *fds = calloc(count, sizeof(int));
+  size_t *sent = calloc(count, sizeof(size_t));
+  if (fds == NULL || sent == NULL) {
+    handle_error("calloc");
+  }
+  for (size_t i = 0; i < count; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[i] == -1) {
+      handle_error("socket");
+    }
+    if (connect(fds[i], (const struct sockaddr *)addr,
+                sizeof(struct sockaddr_in)) == -1) {
+      handle_error("connect");
+    }
+  }
+
+  // Every datagram is the first message of the payload.
+  struct iovec iov = {.iov_base = payload, .iov_len = msg_size};
+  struct mmsghdr msgs[UDP_BATCH];
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t i = 0; i < UDP_BATCH; i++) {
+    msgs[i].msg_hdr.msg_iov = &iov;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  size_t failed = 0;
+  size_t active = count;
+  double start = now_seconds();
+  while (active > 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (sent[i] == per_sock) {
+        continue;
+      }
+      size_t n = per_sock - sent[i] < UDP_BATCH ? per_sock - sent[i]
+                                                : UDP_BATCH;
+      int r = sendmmsg(fds[i], msgs, (unsigned)n, 0);
+      if (r == -1) {
+        if (errno == EINTR || errno == ENOBUFS) {
+          continue;
+        }
+        // Most likely ECONNREFUSED: nothing listens on the port.
+        failed++;
+        r = (int)(per_sock - sent[i]);
+      }
+      sent[i] += (size_t)r;
+      if (sent[i] == per_sock) {
+        active--;
+      }
+    }
+  }
+  double seconds = now_seconds() - start;
+
+  double total = (double)(count - failed) * (double)per_sock;
+  printf("%8zu %9zu %8zu %8zu %10.3f %12.0f %10.1f\n", msg_size, per_sock,
+         count, failed, seconds, total / seconds,
+         total * (double)msg_size / seconds / 1e6);
+  fflush(stdout);
+
+  for (size_t i = 0; i < count; i++) {
+    close(fds[i]);
+  }
+  free(sent);
+  free(fds);
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-c conns,...] [-m messages_per_conn | -B bytes_per_conn] "
+          "[-s msg_size,...] [-F] [-a addr] [-p port]\n"
+          "       %s -r [-n total_conns] [-T threads] [-c in_flight,...] "
+          "[-w] [-e] [-m messages_per_conn] [-s msg_size,...] [-F] "
+          "[-a addr] [-p port]\n"
+          "       %s -U [-c sockets,...] [-m messages_per_socket] "
+          "[-s msg_size,...] [-a addr] [-p port]\n",
+          prog, prog, prog);
+  exit(EXIT_FAILURE);
+}
+
+// Takes the next number off a comma-separated list. Returns 0 at the end.
+long next_in_list(const char **list, const char *prog) {
+  if (**list == '\0') {
+    return 0;
+  }
+  char *end;
+  long value = strtol(*list, &end, 10);
+  if (end == *list || value < 1 || (*end != ',' && *end != '\0')) {
+    usage(prog);
+  }
+  *list = *end == ',' ? end + 1 : end;
+  return value;
+}
+
+int main(int argc, char *argv[]) {
+  const char *conn_counts = DEFAULT_CONN_COUNTS;
+  const char *msg_sizes = DEFAULT_MSG_SIZE;
+  const char *server_addr = ADDR;
+  long messages = -1;
+  long bytes_per_conn = 0;
+  long port = PORT;
+  int rate_mode = 0;
+  long storm_conns = DEFAULT_STORM_CONNS;
+  long num_threads = 1;
+  int waves = 0;
+  int first_byte = 0;
+  int udp = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:m:B:s:Fa:p:rn:T:weU")) != -1) {
+    switch (opt) {
+    case 'r':
+      rate_mode = 1;
+      break;
+    case 'n':
+      storm_conns = strtol(optarg, NULL, 10);
+      break;
+    case 'T':
+      num_threads = strtol(optarg, NULL, 10);
+      break;
+    case 'w':
+      waves = 1;
+      break;
+    case 'e':
+      first_byte = 1;
+      break;
+    case 'U':
+      udp = 1;
+      break;
+    case 'c':
+      conn_counts = optarg;
+      break;
+    case 'm':
+      messages = strtol(optarg, NULL, 10);
+      break;
+    case 'B':
+      bytes_per_conn = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      msg_sizes = optarg;
+      break;
+    case 'F':
+      framed = 1;
+      break;
+    case 'a':
+      server_addr = optarg;
+      break;
+    case 'p':
+      port = strtol(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (messages == -1) {
+    // Connection rate mode is about connecting, so send only one message.
+    messages = rate_mode ? 1 : DEFAULT_MESSAGES;
+  }
+  if (messages < 1 || bytes_per_conn < 0 || port < 1 || port > 65535 ||
+      storm_conns < 1 || num_threads < 1 || (udp && (framed || rate_mode))) {
+    usage(argv[0]);
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  if (inet_pton(AF_INET, server_addr, &addr.sin_addr) <= 0) {
+    handle_error("inet_pton");
+  }
+
+  raise_fd_limit();
+  // A server that closes early must fail the write, not kill us.
+  signal(SIGPIPE, SIG_IGN);
+
+  if (udp) {
+    printf("%8s %9s %8s %8s %10s %12s %10s\n", "size", "msgs/sock", "socks",
+           "failed", "seconds", "sent/s", "MB/s");
+  } else if (rate_mode) {
+    printf("%ld connections from %ld threads per round%s, latency is "
+           "connect to %s\n",
+           storm_conns, num_threads, waves ? " in waves" : "",
+           first_byte ? "first echoed byte" : "close");
+    printf("%8s %9s %8s %8s %8s %10s %10s %10s %10s %10s %10s\n", "size",
+           "msgs/conn", "inflight", "conns", "failed", "seconds", "conns/s",
+           "p50_us", "p99_us", "p99.9_us", "max_us");
+  } else {
+    printf("%8s %9s %8s %8s %12s %10s %12s %10s\n", "size", "msgs/conn",
+           "conns", "failed", "connect_ms", "seconds", "msgs/s", "MB/s");
+  }
+
+  const char *sizes = msg_sizes;
+  long msg_size;
+  while ((msg_size = next_in_list(&sizes, argv[0])) != 0) {
+    long per_conn = messages;
+    if (bytes_per_conn > 0) {
+      per_conn = bytes_per_conn / msg_size > 0 ? bytes_per_conn / msg_size : 1;
+    }
+    fill_payload((size_t)per_conn, (size_t)msg_size);
+
+    const char *counts = conn_counts;
+    long count;
+    while ((count = next_in_list(&counts, argv[0])) != 0) {
+      if (udp) {
+        run_udp_round(&addr, (size_t)count, (size_t)per_conn,
+                      (size_t)msg_size);
+        continue;
+      }
+      if (rate_mode) {
+        printf("%8ld %9ld ", msg_size, per_conn);
+        run_storm_round(&addr, (size_t)count, (size_t)storm_conns,
+                        (size_t)num_threads, waves, first_byte);
+        continue;
+      }
+      struct round_result r = run_round(&addr, (size_t)count);
+      double total_messages = (double)r.connected * (double)per_conn;
+      printf("%8ld %9ld %8ld %8zu %12.1f %10.3f %12.0f %10.1f\n", msg_size,
+             per_conn, count, r.failed, r.connect_seconds * 1e3,
+             r.transfer_seconds, total_messages / r.transfer_seconds,
+             total_messages * (double)msg_size / r.transfer_seconds / 1e6);
+      fflush(stdout);
+    }
+  }
+
+  free(payload);
+  return 0;
+}
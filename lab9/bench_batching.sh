@@ -0,0 +1,32 @@
+#!/bin/bash
+# Receive syscalls per message and messages/sec of the server with plain
+# reads against scatter reads (-v), over TCP and over UDP with recvmmsg. The
+# server prints its statistics to stderr when it is stopped.
+# Usage: ./bench_batching.sh [build dir] [batch]
+
+BUILD=${1:-build-release}
+BATCH=${2:-64}
+PORT=8000
+
+cmake -B "$BUILD" -DCMAKE_BUILD_TYPE=Release > /dev/null
+cmake --build "$BUILD" > /dev/null || exit 1
+
+run() {
+  local bench_args=$1
+  shift
+  echo "== server $*"
+  "$BUILD"/server -q -p $PORT "$@" &
+  server=$!
+  sleep 0.5
+  "$BUILD"/bench -p $PORT $bench_args
+  sleep 0.5
+  kill -INT $server
+  wait $server 2> /dev/null || true
+}
+
+for batch in 1 "$BATCH"; do
+  run "-c 100 -m 10000" -m epoll -v "$batch"
+done
+for batch in 1 "$BATCH"; do
+  run "-U -c 4 -m 250000" -m udp -v "$batch"
+done
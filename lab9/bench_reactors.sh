@@ -0,0 +1,27 @@
+#!/bin/bash
+# Connection rate and connect-to-close latency of the SO_REUSEPORT server with
+# 1, 2, 4 and 8 reactors, against the single-acceptor epoll server.
+# Usage: ./bench_reactors.sh [build dir] [extra bench arguments]
+
+BUILD=${1:-build-release}
+shift
+PORT=8000
+
+cmake -B "$BUILD" -DCMAKE_BUILD_TYPE=Release > /dev/null
+cmake --build "$BUILD" > /dev/null || exit 1
+
+run() {
+  echo "== server $*"
+  "$BUILD"/server -q -p $PORT "$@" &
+  server=$!
+  sleep 0.5
+  "$BUILD"/bench -r -p $PORT -T 4 -c 16,64,256 "${BENCH_ARGS[@]}"
+  kill $server
+  wait $server 2> /dev/null || true
+}
+
+BENCH_ARGS=("$@")
+run -m epoll -t 4
+for reactors in 1 2 4 8; do
+  run -m reuseport -t $reactors
+done
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Messages/sec and connect-to-first-echo latency of the io_uring server
+# against the thread-per-client and epoll servers on loopback.
+# Usage: ./bench_uring.sh [build dir] [extra bench arguments]
+
+BUILD=${1:-build-release}
+shift
+PORT=8000
+
+cmake -B "$BUILD" -DCMAKE_BUILD_TYPE=Release > /dev/null
+cmake --build "$BUILD" > /dev/null || exit 1
+
+run() {
+  local bench_args=$1
+  shift
+  echo "== server $*"
+  "$BUILD"/server -q -p $PORT "$@" &
+  server=$!
+  sleep 0.5
+  "$BUILD"/bench -p $PORT $bench_args "${BENCH_ARGS[@]}"
+  kill -INT $server
+  wait $server 2> /dev/null || true
+  # The kernel lets go of an io_uring server's sockets shortly after it exits.
+  sleep 1
+}
+
+BENCH_ARGS=("$@")
+for mode in threads epoll uring; do
+  run "-c 1,100,1000 -m 2000" -m $mode
+done
+for mode in threads epoll uring; do
+  run "-r -e -n 20000 -c 64,512 -T 2" -m $mode -e
+done
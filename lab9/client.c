@@ -24,6 +24,7 @@
 */
 
 #include <arpa/inet.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +34,11 @@
 #define PORT 8000
 #define BUF_SIZE 64
 #define ADDR "127.0.0.1"
+// With -F, every read from stdin, of up to FRAME_DATA_SIZE bytes, is sent as
+// one frame: a 4-byte length in network byte order, then the data. Run the
+// server with -F too.
+#define FRAME_HEADER_SIZE 4
+#define FRAME_DATA_SIZE (64 * 1024)
 
 #define handle_error(msg)                                                      \
   do {                                                                         \
@@ -40,11 +46,31 @@
     exit(EXIT_FAILURE);                                                        \
   } while (0)
 
-int main() {
+int main(int argc, char *argv[]) {
   struct sockaddr_in addr;
   int sfd;
   ssize_t num_read;
-  char buf[BUF_SIZE];
+  static char frame[FRAME_HEADER_SIZE + FRAME_DATA_SIZE];
+  char *buf = frame + FRAME_HEADER_SIZE;
+  size_t read_size = BUF_SIZE;
+  int framed = 0;
+  long port = PORT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "Fp:")) != -1) {
+    switch (opt) {
+    case 'F':
+      framed = 1;
+      read_size = FRAME_DATA_SIZE;
+      break;
+    case 'p':
+      port = strtol(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-F] [-p port]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
 
   sfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sfd == -1) {
@@ -53,7 +79,7 @@ int main() {
 
   memset(&addr, 0, sizeof(struct sockaddr_in));
   addr.sin_family = AF_INET;
-  addr.sin_port = htons(PORT);
+  addr.sin_port = htons((uint16_t)port);
   if (inet_pton(AF_INET, ADDR, &addr.sin_addr) <= 0) {
     handle_error("inet_pton");
   }
@@ -63,8 +89,15 @@ int main() {
     handle_error("connect");
   }
 
-  while ((num_read = read(STDIN_FILENO, buf, BUF_SIZE)) > 1) {
-    if (write(sfd, buf, num_read) != num_read) {
+  while ((num_read = read(STDIN_FILENO, buf, read_size)) > 1) {
+    if (framed) {
+      uint32_t len = htonl((uint32_t)num_read);
+      memcpy(frame, &len, FRAME_HEADER_SIZE);
+      ssize_t frame_len = FRAME_HEADER_SIZE + num_read;
+      if (write(sfd, frame, frame_len) != frame_len) {
+        handle_error("write");
+      }
+    } else if (write(sfd, buf, num_read) != num_read) {
       handle_error("write");
     }
     printf("Just sent %zd bytes.\n", num_read);
@@ -0,0 +1,545 @@
+// Load generator for server.c running with -e: many connections from a few
+// threads, with the latency of every message taken from its echo.
+//
+// Each of -T threads opens its share of the -c connections to the server on
+// loopback and serves them from its own epoll loop. Messages of -s bytes go
+// out in one of two ways:
+//   - closed loop (default): every connection keeps -w messages in flight
+//     and sends the next one as soon as one has come back;
+//   - fixed rate (-R): the threads together send -R messages/sec, spread
+//     round-robin over their connections, whether or not earlier ones have
+//     come back.
+// The server echoes every byte, in order, so once a connection has read
+// back as many bytes as a message ends at, that message is done. Its
+// latency runs from when it was due to be sent to then, so with -R a
+// server that falls behind shows as latency rather than as a lower rate.
+// Latencies go into a histogram with buckets about 1% wide per thread, and
+// the merged histogram gives the percentiles.
+//
+// After -d seconds no new messages are started. The ones in flight get
+// DRAIN_SECONDS to come back; the rest are counted as lost. Like bench, -F
+// sends frames for a server running with -F, and without it any size works
+// but the server's own message count splits the stream at 63 bytes.
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORT 8000
+// Everything stays on this machine.
+#define ADDR "127.0.0.1"
+#define MAX_EVENTS 256
+#define FRAME_HEADER_SIZE 4
+// Bytes handed to a single write, and read at once.
+#define WRITE_CHUNK (64 * 1024)
+#define READ_CHUNK (64 * 1024)
+// Messages one connection can have sent but not yet back in fixed-rate
+// mode. A message due on a connection that is this far behind is skipped.
+#define MAX_IN_FLIGHT 256
+#define DRAIN_SECONDS 2
+
+#define DEFAULT_CONNS 1000
+#define DEFAULT_THREADS 2
+#define DEFAULT_MSG_SIZE 63
+#define DEFAULT_WINDOW 1
+#define DEFAULT_SECONDS 5
+
+// Histogram buckets: values below 2^HIST_SUB_BITS ns have a bucket each,
+// and every doubling above that is split into 2^(HIST_SUB_BITS - 1)
+// buckets, so a bucket is never wider than 1/128 of its values.
+#define HIST_SUB_BITS 8
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 2) * HIST_HALF)
+
+#define handle_error(msg)                                                      \
+  do {                                                                         \
+    perror(msg);                                                               \
+    exit(EXIT_FAILURE);                                                        \
+  } while (0)
+
+struct histogram {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+};
+
+struct conn {
+  int fd;
+  // Bytes queued to send in total, and of those how many were written and
+  // how many have come back.
+  uint64_t queued;
+  uint64_t written;
+  uint64_t echoed;
+  // When each message in flight was due, oldest at done % max_in_flight.
+  uint64_t *due;
+  uint64_t started; // messages queued
+  uint64_t done;    // messages fully echoed
+  int failed;
+};
+
+struct worker {
+  pthread_t tid;
+  size_t num_conns;
+  double rate; // messages/sec for this thread, or 0 for closed loop
+  struct conn *conns;
+  struct histogram hist;
+  uint64_t sent;
+  uint64_t skipped;
+  uint64_t failed;
+};
+
+// Messages, framed with -F, laid out back to back. Every write starts at
+// offset written % stride, so it lines up with message boundaries.
+char *payload;
+size_t payload_len;
+size_t stride; // bytes per message, header included
+int framed = 0;
+size_t window = DEFAULT_WINDOW;
+size_t max_in_flight; // window, or MAX_IN_FLIGHT with -R
+uint64_t run_ns;
+struct sockaddr_in server_addr;
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void raise_fd_limit(void) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+      perror("setrlimit");
+    }
+  }
+}
+
+void fill_payload(size_t msg_size) {
+  size_t header = framed ? FRAME_HEADER_SIZE : 0;
+  stride = header + msg_size;
+  payload_len = WRITE_CHUNK + stride;
+  payload = malloc(payload_len);
+  if (payload == NULL) {
+    handle_error("malloc");
+  }
+  uint32_t frame_len = htonl((uint32_t)msg_size);
+  for (size_t i = 0; i < payload_len; i += stride) {
+    size_t n = payload_len - i < stride ? payload_len - i : stride;
+    memset(payload + i, 'a' + (int)(i / stride % 26), n);
+    memcpy(payload + i, &frame_len, n < header ? n : header);
+  }
+}
+
+int hist_index(uint64_t value) {
+  if (value < (1 << HIST_SUB_BITS)) {
+    return (int)value;
+  }
+  int shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);
+  return shift * HIST_HALF + (int)(value >> shift);
+}
+
+// The highest value that lands in bucket index.
+uint64_t hist_value(int index) {
+  if (index < (1 << HIST_SUB_BITS)) {
+    return (uint64_t)index;
+  }
+  int shift = index / HIST_HALF - 1;
+  uint64_t sub = (uint64_t)(index - shift * HIST_HALF);
+  return ((sub + 1) << shift) - 1;
+}
+
+void hist_record(struct histogram *h, uint64_t value) {
+  h->counts[hist_index(value)]++;
+  h->total++;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+void hist_merge(struct histogram *into, const struct histogram *from) {
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    into->counts[i] += from->counts[i];
+  }
+  into->total += from->total;
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+}
+
+// The q-quantile in microseconds, as the top of the bucket it falls in.
+double hist_percentile_us(const struct histogram *h, double q) {
+  if (h->total == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(q * (double)h->total);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      uint64_t value = hist_value(i);
+      return (double)(value < h->max ? value : h->max) / 1e3;
+    }
+  }
+  return (double)h->max / 1e3;
+}
+
+// Connects to the server and registers the socket with epfd. Connecting
+// on loopback does not wait long, so it blocks.
+void open_conn(int epfd, struct conn *c) {
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (c->fd == -1) {
+    handle_error("socket");
+  }
+  // Messages are small and latency is the point, so no Nagle delay.
+  int one = 1;
+  if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
+    handle_error("setsockopt");
+  }
+  if (connect(c->fd, (const struct sockaddr *)&server_addr,
+              sizeof(server_addr)) == -1) {
+    handle_error("connect");
+  }
+  int flags = fcntl(c->fd, F_GETFL);
+  if (flags == -1 || fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    handle_error("fcntl");
+  }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+    handle_error("epoll_ctl");
+  }
+}
+
+// Gives up on a connection the server closed or reset. Its messages in
+// flight are lost.
+void fail_conn(struct worker *w, struct conn *c) {
+  c->failed = 1;
+  w->failed++;
+  close(c->fd);
+}
+
+// Writes queued bytes until the socket is full. Returns -1 if the
+// connection failed.
+int flush_conn(struct conn *c) {
+  while (c->written < c->queued) {
+    size_t offset = c->written % stride;
+    uint64_t left = c->queued - c->written;
+    size_t len = left < WRITE_CHUNK ? (size_t)left : WRITE_CHUNK;
+    // MSG_NOSIGNAL: a server that closes early must fail the send, not kill
+    // us.
+    ssize_t n = send(c->fd, payload + offset, len, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    c->written += (uint64_t)n;
+  }
+  return 0;
+}
+
+// Queues one message that was due at due and sends what the socket takes.
+void start_message(struct worker *w, struct conn *c, uint64_t due) {
+  if (c->failed) {
+    return;
+  }
+  if (c->started - c->done == max_in_flight) {
+    w->skipped++;
+    return;
+  }
+  c->due[c->started % max_in_flight] = due;
+  c->started++;
+  c->queued += stride;
+  w->sent++;
+  if (flush_conn(c) == -1) {
+    fail_conn(w, c);
+  }
+}
+
+// Reads everything echoed so far and records the latency of every message
+// that completes. In closed-loop mode while running, each one starts the
+// next, and stops the reading if that fails the connection.
+void read_echoes(struct worker *w, struct conn *c, int running) {
+  char buf[READ_CHUNK];
+  while (!c->failed) {
+    ssize_t n = read(c->fd, buf, sizeof(buf));
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      fail_conn(w, c);
+      return;
+    }
+
+    uint64_t now = now_ns();
+    c->echoed += (uint64_t)n;
+    while (c->done < c->started && c->echoed >= (c->done + 1) * stride) {
+      hist_record(&w->hist, now - c->due[c->done % max_in_flight]);
+      c->done++;
+      if (w->rate == 0 && running) {
+        start_message(w, c, now);
+        if (c->failed) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+// Messages sent but not back yet, over all of the worker's live
+// connections.
+uint64_t in_flight(const struct worker *w) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < w->num_conns; i++) {
+    if (!w->conns[i].failed) {
+      count += w->conns[i].started - w->conns[i].done;
+    }
+  }
+  return count;
+}
+
+void *run_worker(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd == -1) {
+    handle_error("epoll_create1");
+  }
+  for (size_t i = 0; i < w->num_conns; i++) {
+    w->conns[i].due = calloc(max_in_flight, sizeof(uint64_t));
+    if (w->conns[i].due == NULL) {
+      handle_error("calloc");
+    }
+    open_conn(epfd, &w->conns[i]);
+  }
+
+  uint64_t start = now_ns();
+  uint64_t end = start + run_ns;
+  uint64_t next_due = start;
+  uint64_t interval = w->rate > 0 ? (uint64_t)(1e9 / w->rate) : 0;
+  size_t next_conn = 0;
+  if (interval == 0 && w->rate > 0) {
+    interval = 1;
+  }
+
+  if (w->rate == 0) {
+    for (size_t i = 0; i < w->num_conns; i++) {
+      for (size_t k = 0; k < window; k++) {
+        start_message(w, &w->conns[i], start);
+      }
+    }
+  }
+
+  for (;;) {
+    uint64_t now = now_ns();
+    int running = now < end;
+    if (!running && (now >= end + DRAIN_SECONDS * 1000000000ULL ||
+                     in_flight(w) == 0)) {
+      break;
+    }
+
+    // Fixed rate: start every message that is due by now, at the time it
+    // was due.
+    uint64_t wake = running ? end : end + DRAIN_SECONDS * 1000000000ULL;
+    if (w->rate > 0 && running) {
+      while (next_due <= now && next_due < end) {
+        start_message(w, &w->conns[next_conn], next_due);
+        next_conn = (next_conn + 1) % w->num_conns;
+        next_due += interval;
+      }
+      if (next_due < wake) {
+        wake = next_due;
+      }
+    }
+
+    // epoll_pwait2 takes a timeout in nanoseconds, so sends are not
+    // bunched up at millisecond ticks.
+    now = now_ns();
+    uint64_t wait = wake > now ? wake - now : 0;
+    struct timespec timeout = {.tv_sec = (time_t)(wait / 1000000000ULL),
+                               .tv_nsec = (long)(wait % 1000000000ULL)};
+    int n = epoll_pwait2(epfd, events, MAX_EVENTS, &timeout, NULL);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      handle_error("epoll_pwait2");
+    }
+    for (int i = 0; i < n; i++) {
+      struct conn *c = events[i].data.ptr;
+      if (c->failed) {
+        continue;
+      }
+      if (events[i].events & EPOLLOUT && flush_conn(c) == -1) {
+        fail_conn(w, c);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        read_echoes(w, c, running);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < w->num_conns; i++) {
+    if (!w->conns[i].failed) {
+      close(w->conns[i].fd);
+    }
+    free(w->conns[i].due);
+  }
+  close(epfd);
+  return NULL;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-c conns] [-T threads] [-s msg_size] "
+          "[-R msgs_per_sec | -w window] [-d seconds] [-F] [-p port]\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  long num_conns = DEFAULT_CONNS;
+  long num_threads = DEFAULT_THREADS;
+  long msg_size = DEFAULT_MSG_SIZE;
+  double rate = 0;
+  long seconds = DEFAULT_SECONDS;
+  long win = DEFAULT_WINDOW;
+  long port = PORT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:T:s:R:w:d:Fp:")) != -1) {
+    switch (opt) {
+    case 'c':
+      num_conns = strtol(optarg, NULL, 10);
+      break;
+    case 'T':
+      num_threads = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      msg_size = strtol(optarg, NULL, 10);
+      break;
+    case 'R':
+      rate = strtod(optarg, NULL);
+      break;
+    case 'w':
+      win = strtol(optarg, NULL, 10);
+      break;
+    case 'd':
+      seconds = strtol(optarg, NULL, 10);
+      break;
+    case 'F':
+      framed = 1;
+      break;
+    case 'p':
+      port = strtol(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (num_threads < 1 || num_conns < num_threads || msg_size < 1 ||
+      rate < 0 || win < 1 || win > 65536 || seconds < 1 || port < 1 ||
+      port > 65535) {
+    usage(argv[0]);
+  }
+  window = (size_t)win;
+  max_in_flight = rate > 0 ? MAX_IN_FLIGHT : window;
+  run_ns = (uint64_t)seconds * 1000000000ULL;
+
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons((uint16_t)port);
+  if (inet_pton(AF_INET, ADDR, &server_addr.sin_addr) <= 0) {
+    handle_error("inet_pton");
+  }
+
+  raise_fd_limit();
+  fill_payload((size_t)msg_size);
+
+  struct worker *workers = calloc((size_t)num_threads, sizeof(struct worker));
+  if (workers == NULL) {
+    handle_error("calloc");
+  }
+  for (long t = 0; t < num_threads; t++) {
+    struct worker *w = &workers[t];
+    w->num_conns = (size_t)((num_conns + num_threads - 1 - t) / num_threads);
+    w->rate = rate / (double)num_threads;
+    w->conns = calloc(w->num_conns, sizeof(struct conn));
+    if (w->conns == NULL) {
+      handle_error("calloc");
+    }
+    int s = pthread_create(&w->tid, NULL, run_worker, w);
+    if (s != 0) {
+      errno = s;
+      handle_error("pthread_create");
+    }
+  }
+
+  struct histogram *hist = calloc(1, sizeof(struct histogram));
+  if (hist == NULL) {
+    handle_error("calloc");
+  }
+  uint64_t sent = 0;
+  uint64_t skipped = 0;
+  uint64_t failed = 0;
+  for (long t = 0; t < num_threads; t++) {
+    pthread_join(workers[t].tid, NULL);
+    hist_merge(hist, &workers[t].hist);
+    sent += workers[t].sent;
+    skipped += workers[t].skipped;
+    failed += workers[t].failed;
+    free(workers[t].conns);
+  }
+
+  if (rate > 0) {
+    printf("%ld connections from %ld threads, %.0f msgs/s for %ld s\n",
+           num_conns, num_threads, rate, seconds);
+  } else {
+    printf("%ld connections from %ld threads, closed loop with %ld in "
+           "flight each for %ld s\n",
+           num_conns, num_threads, win, seconds);
+  }
+  printf("%8s %10s %10s %8s %8s %6s %10s %10s %10s %10s %10s %10s\n", "size",
+         "sent", "done", "lost", "skipped", "failed", "msgs/s", "p50_us",
+         "p90_us", "p99_us", "p99.9_us", "max_us");
+  printf("%8ld %10lu %10lu %8lu %8lu %6lu %10.0f %10.1f %10.1f %10.1f "
+         "%10.1f %10.1f\n",
+         msg_size, (unsigned long)sent, (unsigned long)hist->total,
+         (unsigned long)(sent - hist->total), (unsigned long)skipped,
+         (unsigned long)failed, (double)hist->total / (double)seconds,
+         hist_percentile_us(hist, 0.5), hist_percentile_us(hist, 0.9),
+         hist_percentile_us(hist, 0.99), hist_percentile_us(hist, 0.999),
+         (double)hist->max / 1e3);
+
+  free(hist);
+  free(workers);
+  free(payload);
+  return 0;
+}
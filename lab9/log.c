@@ -0,0 +1,279 @@
+// Lab 9 - Asynchronous line logger for the server
+#define _GNU_SOURCE
+#include "log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+
+#define handle_error(msg)                                                      \
+  do {                                                                         \
+    perror(msg);                                                               \
+    exit(EXIT_FAILURE);                                                        \
+  } while (0)
+
+// Single-producer, single-consumer byte ring. The owning thread appends
+// lines at tail, the writer takes them from head; both only ever grow, and
+// their difference is the number of bytes buffered.
+struct log_ring {
+  _Alignas(CACHE_LINE) _Atomic size_t tail;
+  _Alignas(CACHE_LINE) _Atomic size_t head;
+  // Set once the owning thread has exited. The writer frees the ring after
+  // it has taken the rest of its lines.
+  _Atomic int closed;
+  struct log_ring *next; // in the writer's list
+  char data[LOG_RING_SIZE];
+};
+
+static int log_async = 0;
+
+static _Thread_local struct log_ring *my_ring;
+static pthread_key_t ring_key;
+
+// Rings of threads that started logging since the writer last looked.
+static struct log_ring *new_rings;
+static pthread_mutex_t new_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The writer sleeps on this when there is nothing to write. A thread whose
+// ring is full wakes it up early.
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static int writer_woken = 0;
+
+// log_flush asks for flush number flush_requested and waits until the
+// writer has finished a pass over all rings that started after the request.
+static pthread_cond_t flush_done = PTHREAD_COND_INITIALIZER;
+static unsigned long flush_requested = 0;
+static unsigned long flush_completed = 0;
+
+static void close_ring(void *arg) {
+  struct log_ring *ring = arg;
+  atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+static struct log_ring *get_ring(void) {
+  if (my_ring != NULL) {
+    return my_ring;
+  }
+  struct log_ring *ring = aligned_alloc(CACHE_LINE, sizeof(struct log_ring));
+  if (ring == NULL) {
+    handle_error("aligned_alloc");
+  }
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->closed, 0);
+
+  pthread_mutex_lock(&new_rings_lock);
+  ring->next = new_rings;
+  new_rings = ring;
+  pthread_mutex_unlock(&new_rings_lock);
+
+  // Marks the ring closed when this thread exits.
+  pthread_setspecific(ring_key, ring);
+  my_ring = ring;
+  return ring;
+}
+
+static void wake_writer(void) {
+  pthread_mutex_lock(&writer_lock);
+  writer_woken = 1;
+  pthread_cond_signal(&writer_wake);
+  pthread_mutex_unlock(&writer_lock);
+}
+
+static void ring_put(struct log_ring *ring, const char *line, size_t len) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  for (;;) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (LOG_RING_SIZE - (tail - head) >= len) {
+      break;
+    }
+    // Full: the writer is behind, so get it going rather than sleep.
+    wake_writer();
+    sched_yield();
+  }
+
+  size_t start = tail % LOG_RING_SIZE;
+  size_t first = LOG_RING_SIZE - start < len ? LOG_RING_SIZE - start : len;
+  memcpy(ring->data + start, line, first);
+  memcpy(ring->data, line + first, len - first);
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
+
+static void write_all(const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(STDOUT_FILENO, buf, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("log write");
+      return;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+}
+
+// Moves everything buffered in ring to out, writing out whenever it fills.
+// Returns the number of bytes taken.
+static size_t drain_ring(struct log_ring *ring, char *out, size_t *out_len) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  size_t taken = tail - head;
+
+  while (head < tail) {
+    if (*out_len == LOG_WRITE_SIZE) {
+      write_all(out, *out_len);
+      *out_len = 0;
+    }
+    size_t start = head % LOG_RING_SIZE;
+    size_t len = tail - head;
+    if (len > LOG_RING_SIZE - start) {
+      len = LOG_RING_SIZE - start;
+    }
+    if (len > LOG_WRITE_SIZE - *out_len) {
+      len = LOG_WRITE_SIZE - *out_len;
+    }
+    memcpy(out + *out_len, ring->data + start, len);
+    *out_len += len;
+    head += len;
+  }
+  atomic_store_explicit(&ring->head, head, memory_order_release);
+  return taken;
+}
+
+static void *run_writer(void *arg) {
+  (void)arg;
+  struct log_ring *rings = NULL;
+  char *out = malloc(LOG_WRITE_SIZE);
+  if (out == NULL) {
+    handle_error("malloc");
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&writer_lock);
+    unsigned long flush = flush_requested;
+    pthread_mutex_unlock(&writer_lock);
+
+    pthread_mutex_lock(&new_rings_lock);
+    while (new_rings != NULL) {
+      struct log_ring *ring = new_rings;
+      new_rings = ring->next;
+      ring->next = rings;
+      rings = ring;
+    }
+    pthread_mutex_unlock(&new_rings_lock);
+
+    size_t out_len = 0;
+    size_t taken = 0;
+    for (struct log_ring **link = &rings; *link != NULL;) {
+      struct log_ring *ring = *link;
+      // Read closed before draining: if it is set, the owner's last line is
+      // already visible, so an empty ring afterwards stays empty.
+      int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+      taken += drain_ring(ring, out, &out_len);
+      if (closed) {
+        *link = ring->next;
+        free(ring);
+      } else {
+        link = &ring->next;
+      }
+    }
+    write_all(out, out_len);
+
+    pthread_mutex_lock(&writer_lock);
+    if (flush_completed != flush) {
+      flush_completed = flush;
+      pthread_cond_broadcast(&flush_done);
+    }
+    pthread_mutex_unlock(&writer_lock);
+
+    if (taken == 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += LOG_IDLE_MS * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_mutex_lock(&writer_lock);
+      while (!writer_woken &&
+             pthread_cond_timedwait(&writer_wake, &writer_lock, &deadline) !=
+                 ETIMEDOUT) {
+      }
+      writer_woken = 0;
+      pthread_mutex_unlock(&writer_lock);
+    }
+  }
+
+  return NULL;
+}
+
+void log_start(int async) {
+  log_async = async;
+  if (!async) {
+    return;
+  }
+
+  int s = pthread_key_create(&ring_key, close_ring);
+  if (s != 0) {
+    errno = s;
+    handle_error("pthread_key_create");
+  }
+  pthread_t tid;
+  s = pthread_create(&tid, NULL, run_writer, NULL);
+  if (s != 0) {
+    errno = s;
+    handle_error("pthread_create");
+  }
+  pthread_detach(tid);
+}
+
+void log_line(const char *fmt, ...) {
+  char line[LOG_LINE_MAX];
+  va_list ap;
+
+  if (!log_async) {
+    flockfile(stdout);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar_unlocked('\n');
+    fflush(stdout);
+    funlockfile(stdout);
+    return;
+  }
+
+  va_start(ap, fmt);
+  int n = vsnprintf(line, LOG_LINE_MAX - 1, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    return;
+  }
+  size_t len = (size_t)n < LOG_LINE_MAX - 2 ? (size_t)n : LOG_LINE_MAX - 2;
+  line[len++] = '\n';
+  ring_put(get_ring(), line, len);
+}
+
+void log_flush(void) {
+  if (!log_async) {
+    return;
+  }
+  pthread_mutex_lock(&writer_lock);
+  unsigned long flush = ++flush_requested;
+  writer_woken = 1;
+  pthread_cond_signal(&writer_wake);
+  while (flush_completed < flush) {
+    pthread_cond_wait(&flush_done, &writer_lock);
+  }
+  pthread_mutex_unlock(&writer_lock);
+}
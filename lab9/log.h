@@ -0,0 +1,30 @@
+// Lab 9 - Asynchronous line logger for the server
+#ifndef LOG_H
+#define LOG_H
+
+// Bytes each logging thread can have buffered before it has to wait for the
+// writer.
+#define LOG_RING_SIZE (32 * 1024)
+// Longer lines are truncated.
+#define LOG_LINE_MAX 256
+// The writer collects lines into one buffer of this size per write().
+#define LOG_WRITE_SIZE (1 << 20)
+// How long the writer sleeps when every ring was empty.
+#define LOG_IDLE_MS 10
+
+// Starts logging to stdout. With async, a writer thread takes the lines from
+// a ring buffer per logging thread and writes them in batches. Otherwise
+// every line goes straight out through stdio with printf and fflush.
+void log_start(int async);
+
+// Logs one line, formatted like printf; the newline is added here. In async
+// mode it only takes the calling thread's own ring, so threads never wait on
+// each other. Lines of one thread stay in order; lines of different threads
+// may be written up to LOG_IDLE_MS apart from when they were logged, and out
+// of order with each other.
+void log_line(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Returns once every line logged before the call has been written.
+void log_flush(void);
+
+#endif
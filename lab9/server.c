@@ -1,15 +1,51 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include "uring.h"
 #include <arpa/inet.h>
 #include <errno.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #define BUF_SIZE 64
 #define PORT 8000
-#define LISTEN_BACKLOG 32
+// The kernel caps this at net.core.somaxconn. 32 drops SYNs as soon as a
+// few hundred clients connect at once.
+#define LISTEN_BACKLOG 4096
+// Events taken from epoll_wait per call in the event loop mode.
+#define MAX_EVENTS 256
+// With -F: frame header size, the largest frame accepted, and how much a
+// client's receive buffer starts with.
+#define FRAME_HEADER_SIZE 4
+#define FRAME_MAX (64 * 1024 * 1024)
+#define RECV_BUF_SIZE (64 * 1024)
+// Defaults for the worker pool mode.
+#define DEFAULT_POOL_SIZE 16
+#define DEFAULT_QUEUE_DEPTH 64
+// Most messages one vectored read or recvmmsg can take with -v.
+#define MAX_BATCH 64
+// Receive buffer asked for on UDP sockets, so bursts are not dropped while a
+// thread is busy printing. The kernel caps it at net.core.rmem_max.
+#define UDP_RCVBUF (4 * 1024 * 1024)
+// io_uring mode: SQEs per ring, and the number and size of the buffers the
+// kernel receives into. A buffer holds MAX_BATCH unframed messages.
+#define URING_ENTRIES 1024
+#define URING_BUFS 1024
+#define URING_BUF_SIZE (MAX_BATCH * (BUF_SIZE - 1))
+// io_uring mode: a client's recv is stopped while more echoed bytes than
+// this wait to be sent, and restarted once half of them have gone.
+#define URING_BACKLOG (256 * 1024)
 
 #define handle_error(msg)                                                      \
   do {                                                                         \
@@ -18,76 +54,717 @@
   } while (0)
 
 // Shared counters for: total # messages, and counter of clients (used for
-// assigning client IDs)
-int total_message_count = 0;
-int client_id_counter = 1;
+// assigning client IDs). Atomic, so no thread ever waits for them.
+atomic_int total_message_count = 0;
+atomic_int client_id_counter = 1;
 
-// Mutexs to protect above global state.
-pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t client_id_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Receive and echo system calls made, including reads that only found
+// EAGAIN or end of stream, and when the first and the latest receive call
+// that returned data were made (CLOCK_MONOTONIC, in ns). print_stats turns
+// them into syscalls per message and messages/sec at exit.
+atomic_ulong receive_calls = 0;
+atomic_ulong echo_calls = 0;
+atomic_llong first_receive_ns = 0;
+atomic_llong last_receive_ns = 0;
+
+// With -q nothing is printed per client or message, so that benchmarks
+// measure the server and not the terminal. Messages are still counted.
+int quiet = 0;
+// With -e every message is also sent back to its client, which lets a
+// benchmark client see when the server has handled it.
+int echo = 0;
+// With -F clients send frames: a 4-byte length in network byte order, then
+// that many bytes of message. Otherwise every read is one message.
+int framed = 0;
+// With -v, one unframed read is a readv into this many BUF_SIZE - 1 byte
+// messages at once, and in UDP mode one recvmmsg takes up to this many
+// datagrams.
+int batch = 1;
+
+// Each thread's chain of message buffers for -v, set up on first use and
+// reused for every read after.
+_Thread_local char chain_bufs[MAX_BATCH][BUF_SIZE];
+_Thread_local struct iovec chain_iov[MAX_BATCH];
+_Thread_local int chain_ready = 0;
 
 struct client_info {
   int cfd;
   int client_id;
+  // With -F, received bytes that do not form a complete frame yet. Grows to
+  // hold the largest frame seen and is reused for every read.
+  char *recv;
+  size_t recv_len;
+  size_t recv_cap;
+  // Echoed bytes a non-blocking socket did not take yet.
+  char *pending;
+  size_t pending_len;
+  size_t pending_cap;
+  // The last read returned less than it had room for, so the socket had
+  // nothing more at that moment.
+  int drained;
+  // io_uring mode only. Echoes collect in pending, and the ring sends them
+  // from out, one send at a time. recv_paused is set while the recv is
+  // stopped for a backlog of echoes. ops counts the client's requests in
+  // flight; once closing is set, it is freed when they have all completed.
+  int ring_echo;
+  int recving;
+  int recv_paused;
+  int sending;
+  char *out;
+  size_t out_len;
+  size_t out_sent;
+  size_t out_cap;
+  int ops;
+  int closing;
 };
 
-void *handle_client(void *arg) {
-  struct client_info *client = (struct client_info *)arg;
-  int cfd = client->cfd;
-  int client_id = client->client_id;
-  ssize_t num_read;
-  char buf[BUF_SIZE];
+int next_client_id(void) {
+  return atomic_fetch_add_explicit(&client_id_counter, 1,
+                                   memory_order_relaxed);
+}
+
+// Counts and prints one message of len bytes in buf. Every server mode goes
+// through here, so they all number and print messages the same way.
+void report_message(int client_id, const char *buf, size_t len) {
+  // Only as much as one unframed message holds is printed. Like %s, %.*s
+  // stops early at a null byte.
+  int print_len = len < BUF_SIZE - 1 ? (int)len : BUF_SIZE - 1;
+
+  // Increment total_message_count in a thread-safe way.
+  int current_msg = atomic_fetch_add_explicit(&total_message_count, 1,
+                                              memory_order_relaxed) +
+                    1;
+
+  if (quiet) {
+    return;
+  }
+  // Print as in the sample output.
+  log_line("Msg #%4d; Client ID %d: %.*s", current_msg, client_id, print_len,
+           buf);
+}
+
+struct iovec *get_chain(void) {
+  if (!chain_ready) {
+    for (int i = 0; i < MAX_BATCH; i++) {
+      chain_iov[i].iov_base = chain_bufs[i];
+      chain_iov[i].iov_len = BUF_SIZE - 1;
+    }
+    chain_ready = 1;
+  }
+  return chain_iov;
+}
+
+long long monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-  // Read messages from this client until it closes the connection.
+// Counts one receive call that returned result.
+void count_receive(ssize_t result) {
+  atomic_fetch_add_explicit(&receive_calls, 1, memory_order_relaxed);
+  if (result <= 0) {
+    return;
+  }
+  long long now = monotonic_ns();
+  long long unset = 0;
+  atomic_compare_exchange_strong_explicit(&first_receive_ns, &unset, now,
+                                          memory_order_relaxed,
+                                          memory_order_relaxed);
+  atomic_store_explicit(&last_receive_ns, now, memory_order_relaxed);
+}
+
+void count_echo(void) {
+  atomic_fetch_add_explicit(&echo_calls, 1, memory_order_relaxed);
+}
+
+// Prints the message count and what it took, to stderr so it stays apart
+// from the messages.
+void print_stats(void) {
+  int messages = atomic_load(&total_message_count);
+  unsigned long calls = atomic_load(&receive_calls);
+  double seconds = (double)(atomic_load(&last_receive_ns) -
+                            atomic_load(&first_receive_ns)) /
+                   1e9;
+  fprintf(stderr,
+          "%d messages, %lu receive calls (%.3f per message), %lu echo calls, "
+          "%.0f msgs/s\n",
+          messages, calls, messages > 0 ? (double)calls / messages : 0.0,
+          atomic_load(&echo_calls), seconds > 0 ? messages / seconds : 0.0);
+}
+
+// Gives a newly accepted connection its client ID. Returns NULL, with the
+// connection closed, if out of memory.
+struct client_info *new_client(int cfd) {
+  struct client_info *client = calloc(1, sizeof(struct client_info));
+  if (client == NULL) {
+    perror("calloc");
+    close(cfd);
+    return NULL;
+  }
+  client->cfd = cfd;
+  client->client_id = next_client_id();
+
+  // With -e, an echo is often shorter than a full segment and would wait
+  // under Nagle for the client's delayed ACK of the one before, for tens of
+  // milliseconds.
+  int one = 1;
+  if (echo &&
+      setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
+    perror("setsockopt");
+  }
+
+  if (!quiet) {
+    log_line("New client created! ID %d on socket FD %d", client->client_id,
+             client->cfd);
+  }
+  return client;
+}
+
+// Closes the connection and frees client. what names the thread or
+// connection that served it in the goodbye line.
+void end_client(struct client_info *client, const char *what) {
+  if (!quiet) {
+    log_line("Ending %s for client %d", what, client->client_id);
+  }
+
+  if (close(client->cfd) == -1) {
+    perror("close");
+  }
+
+  free(client->recv);
+  free(client->pending);
+  free(client->out);
+  free(client);
+}
+
+// Makes *buf hold at least need bytes, at least doubling it. Returns -1 if
+// out of memory.
+int reserve(char **buf, size_t *cap, size_t need) {
+  if (need <= *cap) {
+    return 0;
+  }
+  size_t new_cap = *cap * 2 > need ? *cap * 2 : need;
+  char *p = realloc(*buf, new_cap);
+  if (p == NULL) {
+    return -1;
+  }
+  *buf = p;
+  *cap = new_cap;
+  return 0;
+}
+
+// Returned by receive_messages and the functions under it when an echo
+// failed. The echo has reported why, so the read must not be blamed.
+#define ECHO_FAILED (-2)
+
+// Sends the iovcnt (at most MAX_BATCH) buffers in iov back to the client,
+// in one sendmsg where the socket takes them all. On a blocking socket this
+// returns when all of them are sent. On a non-blocking one, whatever the
+// socket does not take is appended to pending, for flush_pending to send
+// later. Returns -1, with the failure reported, if the connection failed.
+int send_echov(struct client_info *client, const struct iovec *iov,
+               int iovcnt) {
+  struct iovec rest[MAX_BATCH];
+  int first = 0;
+  memcpy(rest, iov, (size_t)iovcnt * sizeof(struct iovec));
+
+  // Anything already pending has to go first. In io_uring mode the ring
+  // sends everything.
+  while (!client->ring_echo && client->pending_len == 0 && first < iovcnt) {
+    struct msghdr msg = {.msg_iov = rest + first,
+                         .msg_iovlen = (size_t)(iovcnt - first)};
+    // MSG_NOSIGNAL: a client that is already gone must not raise SIGPIPE.
+    ssize_t n = sendmsg(client->cfd, &msg, MSG_NOSIGNAL);
+    count_echo();
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("send");
+      return -1;
+    }
+    // Skip what went out, which may end inside a buffer.
+    size_t left = (size_t)n;
+    while (first < iovcnt && left >= rest[first].iov_len) {
+      left -= rest[first].iov_len;
+      first++;
+    }
+    if (first < iovcnt) {
+      rest[first].iov_base = (char *)rest[first].iov_base + left;
+      rest[first].iov_len -= left;
+    }
+  }
+
+  for (; first < iovcnt; first++) {
+    if (reserve(&client->pending, &client->pending_cap,
+                client->pending_len + rest[first].iov_len) == -1) {
+      perror("echo");
+      return -1;
+    }
+    memcpy(client->pending + client->pending_len, rest[first].iov_base,
+           rest[first].iov_len);
+    client->pending_len += rest[first].iov_len;
+  }
+  return 0;
+}
+
+int send_echo(struct client_info *client, const char *data, size_t len) {
+  struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+  return send_echov(client, &iov, 1);
+}
+
+// Sends as much of the client's pending echo as the socket takes. Returns -1,
+// with the failure reported, if the connection failed.
+int flush_pending(struct client_info *client) {
+  size_t sent = 0;
+  while (sent < client->pending_len) {
+    ssize_t n = send(client->cfd, client->pending + sent,
+                     client->pending_len - sent, MSG_NOSIGNAL);
+    count_echo();
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("send");
+      return -1;
+    }
+    sent += (size_t)n;
+  }
+  memmove(client->pending, client->pending + sent, client->pending_len - sent);
+  client->pending_len -= sent;
+  return 0;
+}
+
+// Handles the complete frames at the start of client->recv and keeps the
+// rest for the next read. Returns -1 with errno set on a bad frame, or
+// ECHO_FAILED.
+int handle_frames(struct client_info *client) {
+  size_t used = 0;
+  size_t need = 0;
+
+  while (client->recv_len - used >= FRAME_HEADER_SIZE) {
+    uint32_t frame_len;
+    memcpy(&frame_len, client->recv + used, FRAME_HEADER_SIZE);
+    frame_len = ntohl(frame_len);
+    if (frame_len > FRAME_MAX) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+    if (client->recv_len - used - FRAME_HEADER_SIZE < frame_len) {
+      need = FRAME_HEADER_SIZE + frame_len;
+      break;
+    }
+    report_message(client->client_id, client->recv + used + FRAME_HEADER_SIZE,
+                   frame_len);
+    used += FRAME_HEADER_SIZE + frame_len;
+  }
+
+  // Complete frames are echoed as they came in, header and all.
+  if (echo && used > 0 && send_echo(client, client->recv, used) == -1) {
+    return ECHO_FAILED;
+  }
+  memmove(client->recv, client->recv + used, client->recv_len - used);
+  client->recv_len -= used;
+  // Make room for the whole of a large frame, so it arrives in few reads.
+  if (reserve(&client->recv, &client->recv_cap, need) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+// With -v, reads once into the thread's chain of message buffers. Every
+// buffer readv filled is one message, so the messages are the same as from
+// that many reads of BUF_SIZE - 1 bytes, and they are echoed in one sendmsg.
+ssize_t receive_chain(struct client_info *client) {
+  struct iovec *chain = get_chain();
+  struct iovec out[MAX_BATCH];
+  int count = 0;
+
+  ssize_t num_read = readv(client->cfd, chain, batch);
+  count_receive(num_read);
+  client->drained = num_read < (ssize_t)batch * (BUF_SIZE - 1);
+  if (num_read <= 0) {
+    return num_read;
+  }
+  for (size_t left = (size_t)num_read; left > 0; count++) {
+    size_t len = left < BUF_SIZE - 1 ? left : BUF_SIZE - 1;
+    report_message(client->client_id, chain[count].iov_base, len);
+    out[count].iov_base = chain[count].iov_base;
+    out[count].iov_len = len;
+    left -= len;
+  }
+  if (echo && send_echov(client, out, count) == -1) {
+    return ECHO_FAILED;
+  }
+  return num_read;
+}
+
+// Reads once from the client and handles the messages that completes.
+// Without -F every read of up to BUF_SIZE - 1 bytes is one message; with it
+// a read goes into the client's receive buffer and may complete any number
+// of frames. Returns what read returned, -1 with errno set if a frame is
+// bad, or ECHO_FAILED.
+ssize_t receive_messages(struct client_info *client) {
+  if (!framed && batch > 1) {
+    return receive_chain(client);
+  }
+  if (!framed) {
+    char buf[BUF_SIZE];
+    ssize_t num_read = read(client->cfd, buf, BUF_SIZE - 1);
+    count_receive(num_read);
+    client->drained = num_read < BUF_SIZE - 1;
+    if (num_read > 0) {
+      report_message(client->client_id, buf, (size_t)num_read);
+      if (echo && send_echo(client, buf, (size_t)num_read) == -1) {
+        return ECHO_FAILED;
+      }
+    }
+    return num_read;
+  }
+
+  // Leave room for a good-sized read even after a partial frame.
+  size_t need = client->recv_len + RECV_BUF_SIZE / 4;
+  if (reserve(&client->recv, &client->recv_cap,
+              need > RECV_BUF_SIZE ? need : RECV_BUF_SIZE) == -1) {
+    return -1;
+  }
+  size_t room = client->recv_cap - client->recv_len;
+  ssize_t num_read = read(client->cfd, client->recv + client->recv_len, room);
+  count_receive(num_read);
+  client->drained = num_read < (ssize_t)room;
+  if (num_read > 0) {
+    client->recv_len += (size_t)num_read;
+    int ret = handle_frames(client);
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return num_read;
+}
+
+// Reads messages from a blocking socket until the client closes the
+// connection, echoing them back with -e.
+void serve_client(struct client_info *client) {
   for (;;) {
-    // Leave 1 byte for the null terminator so we can print as a string.
-    num_read = read(cfd, buf, BUF_SIZE - 1);
+    ssize_t num_read = receive_messages(client);
     if (num_read <= 0) {
       // Error or client closed the connection.
       if (num_read == -1) {
         perror("read");
       }
-      break;
+      return;
+    }
+  }
+}
+
+void *handle_client(void *arg) {
+  struct client_info *client = (struct client_info *)arg;
+
+  serve_client(client);
+  end_client(client, "thread");
+
+  return NULL;
+}
+
+// Waits for the next connection on a blocking listening socket.
+int accept_client(int sfd) {
+  for (;;) {
+    struct sockaddr_in caddr;
+    socklen_t caddr_len = sizeof(struct sockaddr_in);
+
+    int cfd = accept(sfd, (struct sockaddr *)&caddr, &caddr_len);
+    if (cfd == -1) {
+      if (errno == EINTR) {
+        continue; // interrupted by signal so try again
+      }
+      handle_error("accept");
     }
+    return cfd;
+  }
+}
 
-    // Null-terminate so printf("%s") is safe.
-    buf[num_read] = '\0';
+// Thread-per-client mode: every accepted connection gets its own detached
+// thread running handle_client.
+void run_thread_per_client(int sfd) {
+  for (;;) {
+    int cfd = accept_client(sfd);
+    struct client_info *client = new_client(cfd);
+    if (client == NULL) {
+      continue;
+    }
 
-    // Increment total_message_count in a thread-safe way.
-    pthread_mutex_lock(&count_mutex);
-    total_message_count++;
-    int current_msg = total_message_count;
-    pthread_mutex_unlock(&count_mutex);
+    pthread_t tid;
+    int s = pthread_create(&tid, NULL, handle_client, client);
+    if (s != 0) {
+      errno = s;
+      perror("pthread_create");
+      close(cfd);
+      free(client);
+      continue;
+    }
 
-    // Print as in the sample output.
-    printf("Msg #%4d; Client ID %d: %s\n", current_msg, client_id, buf);
-    fflush(stdout);
+    s = pthread_detach(tid);
+    if (s != 0) {
+      errno = s;
+      perror("pthread_detach");
+    }
   }
+}
 
-  printf("Ending thread for client %d\n", client_id);
-  fflush(stdout);
+// Pool mode: a fixed number of worker threads serve clients taken from a
+// bounded queue, one client at a time each. Once every worker is busy and
+// the queue is full, the acceptor blocks and stops accepting. New
+// connections then wait in the kernel's listen backlog instead of costing a
+// thread each.
+struct client_queue {
+  struct client_info **slots;
+  size_t capacity;
+  size_t head; // oldest entry
+  size_t count;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
 
-  if (close(cfd) == -1) {
-    perror("close");
+struct client_queue queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+};
+
+void queue_push(struct client_queue *q, struct client_info *client) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == q->capacity) {
+    pthread_cond_wait(&q->not_full, &q->lock);
   }
+  q->slots[(q->head + q->count) % q->capacity] = client;
+  q->count++;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
 
-  free(client);
+struct client_info *queue_pop(struct client_queue *q) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0) {
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  }
+  struct client_info *client = q->slots[q->head];
+  q->head = (q->head + 1) % q->capacity;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return client;
+}
 
+void *run_pool_worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    struct client_info *client = queue_pop(&queue);
+    serve_client(client);
+    end_client(client, "connection");
+  }
   return NULL;
 }
 
-int main() {
+void run_pool(int sfd, size_t num_workers, size_t queue_depth) {
+  queue.capacity = queue_depth;
+  queue.slots = calloc(queue_depth, sizeof(struct client_info *));
+  if (queue.slots == NULL) {
+    handle_error("calloc");
+  }
+
+  for (size_t i = 0; i < num_workers; i++) {
+    pthread_t tid;
+    int s = pthread_create(&tid, NULL, run_pool_worker, NULL);
+    if (s != 0) {
+      errno = s;
+      handle_error("pthread_create");
+    }
+    pthread_detach(tid);
+  }
+
+  for (;;) {
+    struct client_info *client = new_client(accept_client(sfd));
+    if (client != NULL) {
+      queue_push(&queue, client);
+    }
+  }
+}
+
+// Event loop mode: a few threads, each waiting on its own epoll instance, serve
+// all clients. Sockets are non-blocking and registered edge-triggered, so on
+// every event a socket is read until EAGAIN. The first loop also owns the
+// listening socket and hands new clients to the loops round-robin.
+//
+// Reactor mode: every loop opens its own listening socket on the same port
+// with SO_REUSEPORT. The kernel spreads new connections over them by hash,
+// and each loop serves the clients it accepted itself, so no single accept
+// thread limits the connection rate.
+struct event_loop {
+  int epfd;
+  int listen_fd; // -1 in loops that do not accept
+  pthread_t tid;
+};
+
+struct event_loop *loops;
+size_t num_loops;
+int reuseport = 0;
+
+// epoll data.ptr of the listening socket; clients carry their client_info.
+#define LISTENER_TAG NULL
+
+void add_to_loop(struct event_loop *loop, int fd, void *ptr) {
+  struct epoll_event ev;
+  // With -e, EPOLLOUT says when a full socket can take pending echoes.
+  ev.events = EPOLLIN | EPOLLET;
+  // EPOLLRDHUP says the client has closed, so serve_event must read on to
+  // the end of stream rather than stop at a short read.
+  if (ptr != LISTENER_TAG) {
+    ev.events |= EPOLLRDHUP;
+  }
+  if (echo && ptr != LISTENER_TAG) {
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.ptr = ptr;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    handle_error("epoll_ctl");
+  }
+}
+
+// Accepts every connection pending on loop's listening socket. Without
+// SO_REUSEPORT only the first loop accepts, so next_loop needs no lock.
+void accept_clients(struct event_loop *loop) {
+  static size_t next_loop = 0;
+
+  for (;;) {
+    int cfd =
+        accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // Out of file descriptors or memory. The connection stays queued and
+      // is picked up with the next one that arrives.
+      perror("accept4");
+      return;
+    }
+
+    struct client_info *client = new_client(cfd);
+    if (client == NULL) {
+      continue;
+    }
+
+    if (reuseport) {
+      add_to_loop(loop, cfd, client);
+    } else {
+      add_to_loop(&loops[next_loop], cfd, client);
+      next_loop = (next_loop + 1) % num_loops;
+    }
+  }
+}
+
+// Handles any event on a client socket. Reads everything the client has
+// sent so far and handles the messages in it as serve_client does. Closes
+// the connection at end of stream or on error. events are the ones epoll
+// reported.
+//
+// With -e, an echo the socket cannot take at once stays pending and reading
+// pauses until EPOLLOUT brings us back here to flush it. So a client that
+// stops reading its echoes cannot make the server buffer without bound.
+void serve_event(struct client_info *client, uint32_t events) {
+  if (flush_pending(client) == -1) {
+    end_client(client, "connection");
+    return;
+  }
+  if (client->pending_len > 0) {
+    return;
+  }
+
+  for (;;) {
+    ssize_t num_read = receive_messages(client);
+    if (num_read > 0) {
+      if (client->pending_len > 0) {
+        return; // socket full; go on after EPOLLOUT
+      }
+      // A short read emptied the socket, and anything arriving after it
+      // raises a new edge, so the read that would only return EAGAIN can
+      // be skipped.
+      if (client->drained && !(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        return;
+      }
+      continue;
+    }
+    if (num_read == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return; // drained; wait for the next edge
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("read");
+    }
+    break;
+  }
+
+  // Closing the only descriptor also removes it from the epoll set.
+  end_client(client, "connection");
+}
+
+void *run_event_loop(void *arg) {
+  struct event_loop *loop = (struct event_loop *)arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  for (;;) {
+    int n = epoll_wait(loop->epfd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      handle_error("epoll_wait");
+    }
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == LISTENER_TAG) {
+        accept_clients(loop);
+      } else {
+        // Hang-ups and errors also end up here: read returns 0 or -1.
+        serve_event(events[i].data.ptr, events[i].events);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+// Opens a socket listening on port on all interfaces. With share_port, other
+// sockets may listen on the same port at the same time (SO_REUSEPORT).
+int open_listener(long port, int nonblocking, int share_port) {
   struct sockaddr_in addr;
-  int sfd;
+  int type = SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0);
 
-  sfd = socket(AF_INET, SOCK_STREAM, 0);
+  int sfd = socket(AF_INET, type, 0);
   if (sfd == -1) {
     handle_error("socket");
   }
 
+  int one = 1;
+  if (share_port &&
+      setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+    handle_error("setsockopt");
+  }
+
   memset(&addr, 0, sizeof(struct sockaddr_in));
   addr.sin_family = AF_INET;
-  addr.sin_port = htons(PORT);
+  addr.sin_port = htons((uint16_t)port);
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
   if (bind(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) == -1) {
@@ -98,53 +775,655 @@ int main() {
     handle_error("listen");
   }
 
-  for (;;) {
-    struct sockaddr_in caddr;
-    socklen_t caddr_len = sizeof(struct sockaddr_in);
+  return sfd;
+}
 
-    int cfd = accept(sfd, (struct sockaddr *)&caddr, &caddr_len);
-    if (cfd == -1) {
+// Starts count event loops, the first on the calling thread, and never
+// returns. In reactor mode every loop listens on port itself; otherwise only
+// the first one does.
+void run_event_loops(long port, size_t count) {
+  loops = calloc(count, sizeof(struct event_loop));
+  if (loops == NULL) {
+    handle_error("calloc");
+  }
+  num_loops = count;
+
+  for (size_t i = 0; i < count; i++) {
+    loops[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loops[i].epfd == -1) {
+      handle_error("epoll_create1");
+    }
+    // accept_clients relies on accept4 failing with EAGAIN once the backlog
+    // is empty, so listening sockets are non-blocking too.
+    loops[i].listen_fd = -1;
+    if (i == 0 || reuseport) {
+      loops[i].listen_fd = open_listener(port, 1, reuseport);
+      add_to_loop(&loops[i], loops[i].listen_fd, LISTENER_TAG);
+    }
+  }
+
+  for (size_t i = 1; i < count; i++) {
+    int s = pthread_create(&loops[i].tid, NULL, run_event_loop, &loops[i]);
+    if (s != 0) {
+      errno = s;
+      handle_error("pthread_create");
+    }
+  }
+  run_event_loop(&loops[0]);
+}
+
+// UDP mode: every thread has its own socket bound to the port with
+// SO_REUSEPORT, and the kernel spreads senders over them by hash. Every
+// datagram is one message, and the client ID is the sender's port, as
+// there are no connections. Without -v each datagram takes one recvfrom;
+// with it one recvmmsg takes up to that many, and their echoes go back in
+// one sendmmsg.
+int open_udp_socket(long port) {
+  struct sockaddr_in addr;
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    handle_error("socket");
+  }
+
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+    handle_error("setsockopt");
+  }
+  int rcvbuf = UDP_RCVBUF;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1) {
+    perror("setsockopt");
+  }
+
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) == -1) {
+    handle_error("bind");
+  }
+  return fd;
+}
+
+// Sends the count datagrams in msgs back where they came from.
+void echo_datagrams(int fd, struct mmsghdr *msgs, int count) {
+  for (int sent = 0; sent < count;) {
+    int n;
+    if (count - sent == 1) {
+      n = sendmsg(fd, &msgs[sent].msg_hdr, 0) == -1 ? -1 : 1;
+    } else {
+      n = sendmmsg(fd, msgs + sent, (unsigned)(count - sent), 0);
+    }
+    count_echo();
+    if (n == -1) {
       if (errno == EINTR) {
-        continue; // interrupted by signal so try again
+        continue;
       }
-      handle_error("accept");
+      // The sender is gone or the socket is out of buffers; a datagram may
+      // be lost anyway.
+      perror("sendmmsg");
+      return;
     }
+    sent += n;
+  }
+}
 
-    struct client_info *client = malloc(sizeof(struct client_info));
-    if (client == NULL) {
-      perror("malloc");
-      close(cfd);
+void *run_udp_worker(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  struct iovec *chain = get_chain();
+  struct sockaddr_in senders[MAX_BATCH];
+  struct mmsghdr msgs[MAX_BATCH];
+  int n;
+
+  for (;;) {
+    memset(msgs, 0, (size_t)batch * sizeof(struct mmsghdr));
+    for (int i = 0; i < batch; i++) {
+      msgs[i].msg_hdr.msg_name = &senders[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      msgs[i].msg_hdr.msg_iov = &chain[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (batch == 1) {
+      ssize_t len = recvfrom(fd, chain[0].iov_base, chain[0].iov_len, 0,
+                             (struct sockaddr *)&senders[0],
+                             &msgs[0].msg_hdr.msg_namelen);
+      count_receive(len);
+      n = len == -1 ? -1 : 1;
+      msgs[0].msg_len = len == -1 ? 0 : (unsigned)len;
+    } else {
+      // MSG_WAITFORONE: block for the first datagram only, then take
+      // whatever else is already queued.
+      n = recvmmsg(fd, msgs, (unsigned)batch, MSG_WAITFORONE, NULL);
+      count_receive(n);
+    }
+    if (n == -1) {
+      if (errno != EINTR) {
+        perror("recvmmsg");
+      }
       continue;
     }
-    client->cfd = cfd;
 
-    pthread_mutex_lock(&client_id_mutex);
-    client->client_id = client_id_counter++;
-    pthread_mutex_unlock(&client_id_mutex);
+    for (int i = 0; i < n; i++) {
+      report_message(ntohs(senders[i].sin_port), chain[i].iov_base,
+                     msgs[i].msg_len);
+      // Echo exactly what arrived.
+      chain[i].iov_len = msgs[i].msg_len;
+    }
+    if (echo) {
+      echo_datagrams(fd, msgs, n);
+    }
+    for (int i = 0; i < n; i++) {
+      chain[i].iov_len = BUF_SIZE - 1;
+    }
+  }
 
-    printf("New client created! ID %d on socket FD %d\n",
-           client->client_id, client->cfd);
-    fflush(stdout);
+  return NULL;
+}
 
+// Starts count UDP threads, the first on the calling thread, and never
+// returns.
+void run_udp(long port, size_t count) {
+  for (size_t i = 1; i < count; i++) {
+    int fd = open_udp_socket(port);
     pthread_t tid;
-    int s = pthread_create(&tid, NULL, handle_client, client);
+    int s = pthread_create(&tid, NULL, run_udp_worker, (void *)(intptr_t)fd);
     if (s != 0) {
       errno = s;
-      perror("pthread_create");
-      close(cfd);
-      free(client);
-      continue;
+      handle_error("pthread_create");
     }
+    pthread_detach(tid);
+  }
+  run_udp_worker((void *)(intptr_t)open_udp_socket(port));
+}
 
-    s = pthread_detach(tid);
+// io_uring mode: every one of -t threads has its own ring and its own
+// listening socket, shared with SO_REUSEPORT when there are several. One
+// multishot accept takes all connections, and one multishot recv per client
+// keeps delivering its data into buffers the kernel picks from a provided
+// buffer ring. Echoes are sent through the ring as well. Everything queued
+// while handling one batch of completions is submitted by the io_uring_enter
+// that waits for the next batch, so a busy thread makes one system call per
+// batch rather than one per read.
+struct uring_loop {
+  struct uring ring;
+  struct uring_buf_ring bufs;
+  int listen_fd;
+  pthread_t tid;
+};
+
+struct uring_loop *uring_loops;
+
+// user_data of the requests: 0 for the accept, the client_info for a recv,
+// the client_info with SEND_TAG added for a send, and CANCEL_TAG for a
+// cancel, which only completes if it fails.
+#define ACCEPT_TAG 0
+#define SEND_TAG 1
+#define CANCEL_TAG 2
+
+struct io_uring_sqe *get_sqe(struct uring_loop *loop) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+  if (sqe == NULL) {
+    handle_error("io_uring_enter");
+  }
+  return sqe;
+}
+
+void arm_accept(struct uring_loop *loop) {
+  struct io_uring_sqe *sqe = get_sqe(loop);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = loop->listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = ACCEPT_TAG;
+}
+
+void arm_recv(struct uring_loop *loop, struct client_info *client) {
+  struct io_uring_sqe *sqe = get_sqe(loop);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = client->cfd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = (uintptr_t)client;
+  client->recving = 1;
+  client->ops++;
+}
+
+// Echoed bytes of the client's that have not been sent yet.
+size_t uring_backlog(const struct client_info *client) {
+  return client->out_len - client->out_sent + client->pending_len;
+}
+
+// Stops the client's recv while its backlog is over URING_BACKLOG, so a
+// client that sends without reading its echoes cannot grow it without
+// bound. The recv ends with -ECANCELED.
+void pause_recv(struct uring_loop *loop, struct client_info *client) {
+  if (!client->recving || client->recv_paused || client->closing ||
+      uring_backlog(client) <= URING_BACKLOG) {
+    return;
+  }
+  struct io_uring_sqe *sqe = get_sqe(loop);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uintptr_t)client;
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+  sqe->user_data = CANCEL_TAG;
+  client->recv_paused = 1;
+}
+
+// Starts a paused client's recv again once its recv has ended and half of
+// the backlog has been sent.
+void resume_recv(struct uring_loop *loop, struct client_info *client) {
+  if (client->recv_paused && !client->recving && !client->closing &&
+      uring_backlog(client) <= URING_BACKLOG / 2) {
+    client->recv_paused = 0;
+    arm_recv(loop, client);
+  }
+}
+
+// Sends what is left of out, or else moves the pending echoes to out and
+// sends them, unless a send is in flight already.
+void arm_send(struct uring_loop *loop, struct client_info *client) {
+  if (client->sending) {
+    return;
+  }
+  if (client->out_sent == client->out_len) {
+    if (client->pending_len == 0) {
+      return;
+    }
+    char *buf = client->out;
+    size_t cap = client->out_cap;
+    client->out = client->pending;
+    client->out_cap = client->pending_cap;
+    client->out_len = client->pending_len;
+    client->out_sent = 0;
+    client->pending = buf;
+    client->pending_cap = cap;
+    client->pending_len = 0;
+  }
+
+  struct io_uring_sqe *sqe = get_sqe(loop);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = client->cfd;
+  sqe->addr = (uintptr_t)(client->out + client->out_sent);
+  sqe->len = (unsigned)(client->out_len - client->out_sent);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (uintptr_t)client + SEND_TAG;
+  client->sending = 1;
+  client->ops++;
+}
+
+// Stops serving the client after an error. Shutting the socket down ends
+// its recv and any send, and the last of them to complete frees it.
+void fail_client(struct client_info *client) {
+  if (!client->closing) {
+    client->closing = 1;
+    shutdown(client->cfd, SHUT_RDWR);
+  }
+}
+
+// Counts one of the client's requests done, and frees the client if that
+// was the last one and it is closing.
+void finish_op(struct client_info *client) {
+  client->ops--;
+  if (client->closing && client->ops == 0) {
+    end_client(client, "connection");
+  }
+}
+
+// Handles the len bytes of one recv completion the way receive_messages
+// does: without -F they are messages of up to BUF_SIZE - 1 bytes, with it
+// they go into the client's receive buffer to complete frames. Returns -1
+// with errno set if a frame is bad or out of memory, or ECHO_FAILED.
+int handle_data(struct client_info *client, const char *data, size_t len) {
+  if (!framed) {
+    for (size_t done = 0; done < len; done += BUF_SIZE - 1) {
+      size_t n = len - done < BUF_SIZE - 1 ? len - done : BUF_SIZE - 1;
+      report_message(client->client_id, data + done, n);
+    }
+    return echo && send_echo(client, data, len) == -1 ? ECHO_FAILED : 0;
+  }
+
+  if (reserve(&client->recv, &client->recv_cap, client->recv_len + len) ==
+      -1) {
+    return -1;
+  }
+  memcpy(client->recv + client->recv_len, data, len);
+  client->recv_len += len;
+  return handle_frames(client);
+}
+
+void handle_accept(struct uring_loop *loop, const struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    arm_accept(loop);
+  }
+  if (cqe->res < 0) {
+    // Out of file descriptors or memory; the accept goes on with the next.
+    errno = -cqe->res;
+    perror("accept");
+    return;
+  }
+
+  struct client_info *client = new_client(cqe->res);
+  if (client != NULL) {
+    client->ring_echo = 1;
+    arm_recv(loop, client);
+  }
+}
+
+void handle_recv(struct uring_loop *loop, struct client_info *client,
+                 const struct io_uring_cqe *cqe) {
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *data = uring_buf(&loop->bufs, bid);
+    int ret = 0;
+    if (cqe->res > 0 && !client->closing) {
+      ret = handle_data(client, data, (size_t)cqe->res);
+    }
+    if (ret == -1) {
+      perror("recv");
+    }
+    if (ret != 0) {
+      fail_client(client);
+    }
+    uring_buf_put(&loop->bufs, bid);
+  }
+  arm_send(loop, client);
+
+  if (cqe->flags & IORING_CQE_F_MORE) {
+    pause_recv(loop, client);
+    return;
+  }
+  // The recv has ended. It stops by itself when it runs out of buffers or
+  // completions, and then simply starts again, unless it is paused.
+  client->recving = 0;
+  if (!client->closing &&
+      (cqe->res > 0 || cqe->res == -ENOBUFS || cqe->res == -ECANCELED)) {
+    if (!client->recv_paused && uring_backlog(client) <= URING_BACKLOG) {
+      arm_recv(loop, client);
+    } else {
+      client->recv_paused = 1;
+      resume_recv(loop, client);
+    }
+  } else {
+    if (cqe->res < 0) {
+      errno = -cqe->res;
+      perror("recv");
+    }
+    // End of stream or error. Echoes still in flight are let finish.
+    client->closing = 1;
+  }
+  finish_op(client);
+}
+
+void handle_send(struct uring_loop *loop, struct client_info *client,
+                 const struct io_uring_cqe *cqe) {
+  client->sending = 0;
+  if (cqe->res < 0) {
+    if (!client->closing) {
+      errno = -cqe->res;
+      perror("send");
+    }
+    client->out_sent = client->out_len;
+    client->pending_len = 0;
+    fail_client(client);
+  } else {
+    client->out_sent += (size_t)cqe->res;
+    arm_send(loop, client);
+    resume_recv(loop, client);
+  }
+  finish_op(client);
+}
+
+// Sets up the calling thread's ring and buffers. Returns -1 with errno set
+// if io_uring is not available.
+int init_uring_loop(struct uring_loop *loop) {
+  if (uring_init(&loop->ring, URING_ENTRIES) == -1) {
+    return -1;
+  }
+  if (uring_setup_buf_ring(&loop->ring, &loop->bufs, 0, URING_BUFS,
+                           URING_BUF_SIZE) == -1) {
+    int saved = errno;
+    uring_exit(&loop->ring);
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+void *run_uring_loop(void *arg) {
+  struct uring_loop *loop = (struct uring_loop *)arg;
+
+  // A ring belongs to the thread that set it up, so other loops set theirs
+  // up here.
+  if (loop != &uring_loops[0] && init_uring_loop(loop) == -1) {
+    handle_error("io_uring_setup");
+  }
+  arm_accept(loop);
+
+  for (;;) {
+    if (uring_enter(&loop->ring, 1) == -1 && errno != EINTR) {
+      handle_error("io_uring_enter");
+    }
+
+    ssize_t completed = 0;
+    struct io_uring_cqe *next;
+    while ((next = uring_peek_cqe(&loop->ring)) != NULL) {
+      struct io_uring_cqe cqe = *next;
+      uring_cqe_seen(&loop->ring);
+      completed++;
+
+      if (cqe.user_data == ACCEPT_TAG) {
+        handle_accept(loop, &cqe);
+      } else if (cqe.user_data == CANCEL_TAG) {
+        // The recv had ended already, and its own completion restarts it
+        // if need be.
+      } else if (cqe.user_data & SEND_TAG) {
+        handle_send(loop, (struct client_info *)(cqe.user_data - SEND_TAG),
+                    &cqe);
+      } else {
+        handle_recv(loop, (struct client_info *)cqe.user_data, &cqe);
+      }
+    }
+    // io_uring_enter is this mode's only receive call.
+    count_receive(completed);
+  }
+
+  return NULL;
+}
+
+// Starts count io_uring loops, the first on the calling thread, and never
+// returns. Falls back to count epoll loops if io_uring is not available.
+void run_uring(long port, size_t count) {
+  uring_loops = calloc(count, sizeof(struct uring_loop));
+  if (uring_loops == NULL) {
+    handle_error("calloc");
+  }
+  if (init_uring_loop(&uring_loops[0]) == -1) {
+    fprintf(stderr, "io_uring not available (%s), using epoll\n",
+            strerror(errno));
+    free(uring_loops);
+    run_event_loops(port, count);
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    uring_loops[i].listen_fd = open_listener(port, 0, count > 1);
+  }
+  for (size_t i = 1; i < count; i++) {
+    int s = pthread_create(&uring_loops[i].tid, NULL, run_uring_loop,
+                           &uring_loops[i]);
     if (s != 0) {
       errno = s;
-      perror("pthread_detach");
-    } 
+      handle_error("pthread_create");
+    }
+  }
+  run_uring_loop(&uring_loops[0]);
+}
+
+// Every client costs a file descriptor in all modes, and the default soft
+// limit of 1024 is far below what any of them can serve.
+void raise_fd_limit(void) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+      perror("setrlimit");
+    }
+  }
+}
+
+// Waits for SIGINT or SIGTERM, then writes out the lines still buffered in
+// the logger and the statistics before exiting.
+void *run_signal_thread(void *arg) {
+  sigset_t *signals = (sigset_t *)arg;
+  int sig;
+
+  sigwait(signals, &sig);
+  log_flush();
+  print_stats();
+  exit(EXIT_SUCCESS);
+}
+
+// Blocks SIGINT and SIGTERM in this thread and every thread created after,
+// and hands them to a thread of their own.
+void start_signal_thread(void) {
+  static sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+
+  int s = pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  if (s != 0) {
+    errno = s;
+    handle_error("pthread_sigmask");
+  }
+
+  pthread_t tid;
+  s = pthread_create(&tid, NULL, run_signal_thread, &signals);
+  if (s != 0) {
+    errno = s;
+    handle_error("pthread_create");
+  }
+  pthread_detach(tid);
+}
+
+enum server_mode {
+  MODE_THREADS,
+  MODE_POOL,
+  MODE_EPOLL,
+  MODE_REUSEPORT,
+  MODE_UDP,
+  MODE_URING
+};
+
+const char *const mode_names[] = {
+    [MODE_THREADS] = "threads",
+    [MODE_POOL] = "pool",
+    [MODE_EPOLL] = "epoll",
+    [MODE_REUSEPORT] = "reuseport",
+    [MODE_UDP] = "udp",
+    [MODE_URING] = "uring",
+};
+
+int parse_mode(const char *name, enum server_mode *mode) {
+  for (size_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+    if (strcmp(name, mode_names[i]) == 0) {
+      *mode = (enum server_mode)i;
+      return 0;
+    }
   }
+  return -1;
+}
 
-  if (close(sfd) == -1) {
-    handle_error("close");
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-m threads|pool|epoll|reuseport|udp|uring] "
+          "[-t threads] [-Q queue_depth] [-p port] [-v batch] [-e] [-F] [-q] "
+          "[-S]\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  enum server_mode mode = MODE_THREADS;
+  long thread_count = 0;
+  long queue_depth = DEFAULT_QUEUE_DEPTH;
+  long port = PORT;
+  int sync_log = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:t:Q:p:v:eFqS")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (parse_mode(optarg, &mode) == -1) {
+        usage(argv[0]);
+      }
+      break;
+    case 't':
+      thread_count = strtol(optarg, NULL, 10);
+      if (thread_count < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 'Q':
+      queue_depth = strtol(optarg, NULL, 10);
+      if (queue_depth < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 'e':
+      echo = 1;
+      break;
+    case 'F':
+      framed = 1;
+      break;
+    case 'p':
+      port = strtol(optarg, NULL, 10);
+      if (port < 1 || port > 65535) {
+        usage(argv[0]);
+      }
+      break;
+    case 'v':
+      batch = (int)strtol(optarg, NULL, 10);
+      if (batch < 1 || batch > MAX_BATCH) {
+        usage(argv[0]);
+      }
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    case 'S':
+      sync_log = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  raise_fd_limit();
+  start_signal_thread();
+  log_start(!sync_log);
+
+  if (mode == MODE_THREADS) {
+    int sfd = open_listener(port, 0, 0);
+    run_thread_per_client(sfd);
+    if (close(sfd) == -1) {
+      handle_error("close");
+    }
+  } else if (mode == MODE_POOL) {
+    int sfd = open_listener(port, 0, 0);
+    run_pool(sfd, thread_count ? (size_t)thread_count : DEFAULT_POOL_SIZE,
+             (size_t)queue_depth);
+  } else if (mode == MODE_URING) {
+    run_uring(port, thread_count ? (size_t)thread_count : 1);
+  } else if (mode == MODE_UDP) {
+    run_udp(port, thread_count ? (size_t)thread_count : 1);
+  } else {
+    reuseport = mode == MODE_REUSEPORT;
+    run_event_loops(port, thread_count ? (size_t)thread_count : 1);
   }
 
   return 0;
@@ -0,0 +1,193 @@
+// Lab 9 - Minimal io_uring interface on the raw system calls
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The kernel reads and writes the ring indices concurrently with us.
+#define load_acquire(p)                                                        \
+  atomic_load_explicit((_Atomic unsigned *)(p), memory_order_acquire)
+#define store_release(p, v)                                                    \
+  atomic_store_explicit((_Atomic unsigned *)(p), (v), memory_order_release)
+
+int uring_init(struct uring *ring, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(ring, 0, sizeof(*ring));
+  // Only this thread submits, and completions are only processed when we
+  // wait for them, so the kernel never interrupts us to post them.
+  p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+            IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+  p.cq_entries = entries * 4;
+
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd == -1) {
+    return -1;
+  }
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+  char *sq = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    goto fail;
+  }
+  ring->sq_ring = sq;
+  char *cq = sq;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      goto fail;
+    }
+  }
+  ring->cq_ring = cq;
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  struct io_uring_sqe *sqes =
+      mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    goto fail;
+  }
+  ring->sqes = sqes;
+
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  // SQE i always sits in slot i of the index array, so only the tail has
+  // to move when submitting.
+  unsigned *array = (unsigned *)(sq + p.sq_off.array);
+  for (unsigned i = 0; i < p.sq_entries; i++) {
+    array[i] = i;
+  }
+  return 0;
+
+fail:;
+  int saved = errno;
+  uring_exit(ring);
+  errno = saved;
+  return -1;
+}
+
+void uring_exit(struct uring *ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != NULL) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->fd != -1) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+  while (ring->sqe_tail - load_acquire(ring->sq_head) == ring->sq_entries) {
+    if (uring_enter(ring, 0) == -1 && errno != EINTR && errno != EBUSY) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int uring_enter(struct uring *ring, unsigned wait_nr) {
+  store_release(ring->sq_tail, ring->sqe_tail);
+  unsigned to_submit = ring->sqe_tail - load_acquire(ring->sq_head);
+  // GETEVENTS even without waiting: with DEFER_TASKRUN that is when
+  // completions are posted.
+  int n = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+  return n == -1 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+  unsigned head = *ring->cq_head;
+  if (head == load_acquire(ring->cq_tail)) {
+    return NULL;
+  }
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring) {
+  store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+int uring_setup_buf_ring(struct uring *ring, struct uring_buf_ring *br,
+                         unsigned short bgid, unsigned entries,
+                         unsigned buf_size) {
+  size_t ring_size = entries * sizeof(struct io_uring_buf);
+  long page = sysconf(_SC_PAGESIZE);
+  br->br = aligned_alloc((size_t)page,
+                         (ring_size + (size_t)page - 1) / page * page);
+  br->bufs = malloc((size_t)entries * buf_size);
+  if (br->br == NULL || br->bufs == NULL) {
+    free(br->br);
+    free(br->bufs);
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(br->br, 0, ring_size);
+  br->entries = entries;
+  br->buf_size = buf_size;
+  br->tail = 0;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)br->br;
+  reg.ring_entries = entries;
+  reg.bgid = bgid;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) == -1) {
+    free(br->br);
+    free(br->bufs);
+    return -1;
+  }
+
+  for (unsigned i = 0; i < entries; i++) {
+    uring_buf_put(br, (unsigned short)i);
+  }
+  return 0;
+}
+
+char *uring_buf(struct uring_buf_ring *br, unsigned short bid) {
+  return br->bufs + (size_t)bid * br->buf_size;
+}
+
+void uring_buf_put(struct uring_buf_ring *br, unsigned short bid) {
+  struct io_uring_buf *buf = &br->br->bufs[br->tail & (br->entries - 1)];
+  buf->addr = (unsigned long)uring_buf(br, bid);
+  buf->len = br->buf_size;
+  buf->bid = bid;
+  br->tail++;
+  // The tail is 16 bits wide and shares its word with the last entry's
+  // reserved field.
+  atomic_store_explicit((_Atomic unsigned short *)&br->br->tail, br->tail,
+                        memory_order_release);
+}
@@ -0,0 +1,79 @@
+// Lab 9 - Minimal io_uring interface on the raw system calls
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+// One ring, mapped into our memory. Only the thread that set it up may use
+// it.
+struct uring {
+  int fd;
+  // Submission queue. SQEs are filled in at sqe_tail and handed to the
+  // kernel by moving *sq_tail up to it in uring_enter.
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sqe_tail;
+  struct io_uring_sqe *sqes;
+  // Completion queue. The kernel adds CQEs at *cq_tail, we take them at
+  // *cq_head.
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  // The mappings, for uring_exit. cq_ring is sq_ring when the kernel maps
+  // both queues at once.
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+};
+
+// A ring of equal buffers the kernel picks from for recv requests with
+// IOSQE_BUFFER_SELECT. The CQE says which one it took, and the buffer stays
+// ours until uring_buf_put gives it back.
+struct uring_buf_ring {
+  struct io_uring_buf_ring *br;
+  char *bufs;
+  unsigned entries;
+  unsigned buf_size;
+  unsigned short tail;
+};
+
+// Sets up a ring with room for entries SQEs and four times as many CQEs.
+// Needs Linux 6.1 or later. Returns -1 with errno set if the kernel does not
+// have it or does not allow it.
+int uring_init(struct uring *ring, unsigned entries);
+
+// Unmaps the ring and closes it. Also takes a ring uring_init failed to set
+// up completely.
+void uring_exit(struct uring *ring);
+
+// Returns a zeroed SQE to fill in, submitting the ones already filled in
+// first if the queue is full.
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+// Submits every SQE filled in so far and waits until at least wait_nr CQEs
+// are ready. Returns -1 with errno set on error.
+int uring_enter(struct uring *ring, unsigned wait_nr);
+
+// Returns the oldest CQE, or NULL if there is none. uring_cqe_seen hands it
+// back to the kernel, so copy what is needed first.
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+// Registers entries (a power of two) buffers of buf_size bytes as buffer
+// group bgid, all available to the kernel. Returns -1 with errno set on
+// error.
+int uring_setup_buf_ring(struct uring *ring, struct uring_buf_ring *br,
+                         unsigned short bgid, unsigned entries,
+                         unsigned buf_size);
+
+// The buffer with ID bid, and giving it back to the kernel when done.
+char *uring_buf(struct uring_buf_ring *br, unsigned short bid);
+void uring_buf_put(struct uring_buf_ring *br, unsigned short bid);
+
+#endif